@@ -21,6 +21,9 @@ proc main() =
   var srcHeight = cint(-1)
   var dstWidth = cint(-1)
   var dstHeight = cint(-1)
+  var previewWidth = cint(0)
+  var previewHeight = cint(0)
+  var frame = 0
   for hdr in getEnvEmpty("REQUEST_HEADERS").split('\n'):
     let k = hdr.until(':')
     let v = hdr.after(':').strip()
@@ -29,16 +32,32 @@ proc main() =
       (dstWidth, dstHeight) = parseDimensionsC(v, allowZero = false)
     of "Cha-Image-Dimensions":
       (srcWidth, srcHeight) = parseDimensionsC(v, allowZero = false)
+    of "Cha-Image-Preview-Dimensions":
+      (previewWidth, previewHeight) = parseDimensionsC(v, allowZero = false)
+    of "Cha-Image-Frame":
+      # input is a sequence of frames; resize the one with this index
+      frame = int(parseUInt32(v, allowSign = false).get(0))
   let ps = newPosixStream(STDIN_FILENO)
   let os = newPosixStream(STDOUT_FILENO)
-  let src = ps.readLoopOrMmap(int(srcWidth * srcHeight * 4))
+  let frameLen = int(srcWidth) * int(srcHeight) * 4
+  let src = ps.readLoopOrMmap(frameLen * (frame + 1))
   let dst = os.maybeMmapForSend(int(dstWidth * dstHeight * 4 + 1))
   if src == nil or dst == nil:
     cgiDie(ceInternalError, "failed to open i/o")
   dst.p[0] = uint8('\n') # for CGI
   enterNetworkSandbox()
-  doAssert stbir_resize_uint8_srgb(addr src.p[0], srcWidth, srcHeight, 0,
-    addr dst.p[1], dstWidth, dstHeight, 0, 4, 3, 0) != 0
+  if previewWidth > 0:
+    # Preview mode: shrink the image to a few pixels, then blow it back up
+    # to the target size.  The result is blurry, but it is quick to
+    # compute and still gives a rough idea of the image's colors.
+    var tmp = newSeq[uint8](int(previewWidth * previewHeight * 4))
+    doAssert stbir_resize_uint8_srgb(addr src.p[frameLen * frame], srcWidth,
+      srcHeight, 0, addr tmp[0], previewWidth, previewHeight, 0, 4, 3, 0) != 0
+    doAssert stbir_resize_uint8_srgb(addr tmp[0], previewWidth,
+      previewHeight, 0, addr dst.p[1], dstWidth, dstHeight, 0, 4, 3, 0) != 0
+  else:
+    doAssert stbir_resize_uint8_srgb(addr src.p[frameLen * frame], srcWidth,
+      srcHeight, 0, addr dst.p[1], dstWidth, dstHeight, 0, 4, 3, 0) != 0
   discard os.writeLoop(dst)
   deallocMem(src)
   deallocMem(dst)
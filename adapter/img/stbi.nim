@@ -27,6 +27,67 @@ import ../protocol/lcgi
 #define STBI_NO_PIC
 #define STBI_NO_PNM /* (.ppm and .pgm) */
 #include "stb_image.h"
+
+/* Like stbi__load_gif_main, but decodes from callbacks and stops once
+ * there are more than max_frames frames or max_bytes bytes of them, so
+ * that oversized animations never get allocated.  In that case, *z is set
+ * to max_frames + 1 and only the frames that fit are returned. */
+static stbi_uc *cha_load_gif_frames(stbi_io_callbacks *clbk, void *user,
+  int **delays, int *x, int *y, int *z, int max_frames, size_t max_bytes)
+{
+   stbi__context s;
+   stbi__gif g;
+   stbi_uc *out = 0;
+   stbi_uc *two_back = 0;
+   int layers = 0;
+   stbi__start_callbacks(&s, clbk, user);
+   *delays = 0;
+   *z = 0;
+   if (!stbi__gif_test(&s))
+      return stbi__errpuc("not GIF", "Image was not as a gif type.");
+   memset(&g, 0, sizeof(g));
+   for (;;) {
+      int comp;
+      stbi_uc *u = stbi__gif_load_next(&s, &g, &comp, 4, two_back);
+      size_t stride;
+      void *tmp;
+      if (u == 0 || u == (stbi_uc *) &s) /* error or end of animation */
+         break;
+      stride = (size_t) g.w * g.h * 4;
+      if (stride == 0)
+         break;
+      if (layers > 0 && (layers >= max_frames ||
+            (size_t) (layers + 1) > max_bytes / stride)) {
+         layers = max_frames + 1;
+         break;
+      }
+      *x = g.w;
+      *y = g.h;
+      ++layers;
+      tmp = STBI_REALLOC(out, layers * stride);
+      if (tmp)
+         out = (stbi_uc *) tmp;
+      tmp = tmp ? STBI_REALLOC(*delays, sizeof(int) * layers) : 0;
+      if (!tmp) {
+         STBI_FREE(out);
+         STBI_FREE(*delays);
+         out = 0;
+         *delays = 0;
+         stbi__err("outofmem", "Out of memory");
+         break;
+      }
+      *delays = (int *) tmp;
+      memcpy(out + (layers - 1) * stride, u, stride);
+      (*delays)[layers - 1] = g.delay;
+      if (layers >= 2)
+         two_back = out + (layers - 2) * stride;
+   }
+   STBI_FREE(g.out);
+   STBI_FREE(g.history);
+   STBI_FREE(g.background);
+   *z = layers;
+   return out;
+}
 """.}
 
 type stbi_io_callbacks {.importc.} = object
@@ -38,6 +99,10 @@ proc stbi_load_from_callbacks(clbk: ptr stbi_io_callbacks; user: pointer;
   x, y, channels_in_file: var cint; desired_channels: cint):
   ptr uint8 {.importc.}
 
+proc cha_load_gif_frames(clbk: ptr stbi_io_callbacks; user: pointer;
+  delays: ptr ptr cint; x, y, z: var cint; max_frames: cint;
+  max_bytes: csize_t): ptr uint8 {.importc.}
+
 proc stbi_info_from_callbacks(clbk: ptr stbi_io_callbacks; user: pointer;
   x, y, comp: var cint): cint {.importc.}
 
@@ -107,12 +172,67 @@ proc puts(s: string) =
   if s.len > 0:
     writeAll(unsafeAddr s[0], s.len)
 
+# Decode all frames of an animated GIF, if there are at most maxFrames
+# and they take at most maxBytes.  Frames are decoded one at a time, and
+# decoding stops as soon as the animation is over budget; then we only
+# output the first frame.
+proc decodeGifFrames(maxFrames, maxBytes: int) =
+  enterNetworkSandbox()
+  var user = StbiUser()
+  var clbk = stbi_io_callbacks(
+    read: myRead,
+    skip: mySkip,
+    eof: myEof
+  )
+  var delays: ptr cint = nil
+  var x: cint
+  var y: cint
+  var z: cint
+  let p = cha_load_gif_frames(addr clbk, addr user, addr delays, x, y, z,
+    cint(maxFrames), csize_t(maxBytes))
+  if p == nil:
+    if delays != nil:
+      stbi_image_free(delays)
+    cgiDie(ceInternalError, stbi_failure_reason())
+  # if the animation doesn't fit in the budget, show it as a still image.
+  let n = if int(z) <= maxFrames and delays != nil: int(z) else: 1
+  var s = "Cha-Image-Dimensions: " & $x & "x" & $y & "\n"
+  if n > 1:
+    let delays = cast[ptr UncheckedArray[cint]](delays)
+    s &= "Cha-Image-Frame-Count: " & $n & "\nCha-Image-Frame-Delays: "
+    for i in 0 ..< n:
+      if i > 0:
+        s &= ','
+      s &= $delays[i]
+    s &= '\n'
+  puts(s & '\n')
+  writeAll(p, int(x) * int(y) * 4 * n)
+  stbi_image_free(p)
+  if delays != nil:
+    stbi_image_free(delays)
+
 proc main() =
   let f = getEnvEmpty("MAPPED_URI_SCHEME").after('+')
   case getEnvEmpty("MAPPED_URI_PATH")
   of "decode":
     if f notin ["jpeg", "gif", "bmp", "png", "x-unknown"]:
       cgiDie(ceInternalError, "unknown format " & f)
+    var infoOnly = false
+    var maxFrames = 1
+    var maxBytes = int.high
+    for hdr in getEnvEmpty("REQUEST_HEADERS").split('\n'):
+      let v = hdr.after(':').strip()
+      case hdr.until(':')
+      of "Cha-Image-Info-Only":
+        infoOnly = v == "1"
+      of "Cha-Image-Max-Frames":
+        maxFrames = int(parseUInt32(v, allowSign = false).get(1))
+      of "Cha-Image-Max-Bytes":
+        maxBytes = int(parseUInt32(v, allowSign = false).get(0))
+      else: discard
+    if f == "gif" and maxFrames > 1 and not infoOnly:
+      decodeGifFrames(maxFrames, maxBytes)
+      quit(0)
     enterNetworkSandbox()
     var user = StbiUser()
     var x: cint
@@ -123,12 +243,6 @@ proc main() =
       skip: mySkip,
       eof: myEof
     )
-    var infoOnly = false
-    for hdr in getEnvEmpty("REQUEST_HEADERS").split('\n'):
-      let v = hdr.after(':').strip()
-      if hdr.until(':') == "Cha-Image-Info-Only":
-        infoOnly = v == "1"
-        break
     if infoOnly:
       if stbi_info_from_callbacks(addr clbk, addr user, x, y,
           channels_in_file) == 1:
@@ -47535,6 +47535,12 @@ static void js_random_init(JSContext *ctx)
         ctx->random_state = 1;
 }
 
+/* Reseed Math.random, e.g. after forking a process that owns ctx. */
+void JS_ResetRandomSeed(JSContext *ctx)
+{
+    js_random_init(ctx);
+}
+
 static JSValue js_math_random(JSContext *ctx, JSValueConst this_val,
                               int argc, JSValueConst *argv)
 {
@@ -457,6 +457,7 @@ proc JS_NewRuntime*(): JSRuntime
 proc JS_SetRuntimeInfo*(rt: JSRuntime; info: cstringConst) ##
   ## info lifetime must
   ## exceed that of rt
+proc JS_SetMemoryLimit*(rt: JSRuntime; limit: csize_t)
 proc JS_GetGCThreshold*(rt: JSRuntime): csize_t
 proc JS_SetGCThreshold*(rt: JSRuntime; gc_threshold: csize_t)
 proc JS_SetMaxStackSize*(rt: JSRuntime; stack_size: csize_t) ##
@@ -480,6 +481,8 @@ proc JS_DupContext*(ctx: JSContext): JSContext
 proc JS_SetContextOpaque*(ctx: JSContext; opaque: pointer)
 proc JS_GetContextOpaque*(ctx: JSContext): pointer
 proc JS_GetRuntime*(ctx: JSContext): JSRuntime
+proc JS_ResetRandomSeed*(ctx: JSContext) ##
+  ## reseed Math.random, e.g. after forking a process that owns ctx
 proc JS_SetClassProto*(ctx: JSContext; class_id: JSClassID; obj: JSValue)
 proc JS_GetClassProto*(ctx: JSContext; class_id: JSClassID): JSValue
 
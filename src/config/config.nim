@@ -91,7 +91,7 @@ type
     scriptingMode*: ScriptingMode
 
   ConfigOptionHWord {.union.} = object
-    int32: int32
+    int32*: int32
     formatModeAuto: FormatModeAuto
 
   # RGBColor or -1 for auto
@@ -182,18 +182,23 @@ type
     coHistory = "history"
     coIgnoreCase = "ignoreCase"
     coImageMode = "imageMode"
+    coImagePreview = "imagePreview"
     coImages = "images"
     coMarkLinks = "markLinks"
     coMetaRefresh = "metaRefresh"
     coNoFormatMode = "noFormatMode"
     coOsc52Copy = "osc52Copy"
     coOsc52Primary = "osc52Primary"
+    coPersistentStorage = "persistentStorage"
     coRefererFrom = "refererFrom"
+    coReshapeStats = "reshapeStats"
+    coScriptCache = "scriptCache"
     coScripting = "scripting"
     coSetTitle = "setTitle"
     coShowCursorPosition = "showCursorPosition"
     coShowDownloadPanel = "showDownloadPanel"
     coShowHoverLink = "showHoverLink"
+    coStyleCache = "styleCache"
     coStyling = "styling"
     coUseMouse = "useMouse"
     coViNumericPrefix = "viNumericPrefix"
@@ -204,6 +209,8 @@ type
     coColumns = "columns"
     coFormatModeDisplay = "display.formatMode"
     coHistorySize = "historySize"
+    coJsGcThreshold = "jsGcThreshold"
+    coJsMemoryLimit = "jsMemoryLimit"
     coLines = "lines"
     coMaxNetConnections = "maxNetConnections"
     coMaxRedirect = "maxRedirect"
@@ -335,18 +342,23 @@ const OptionMap = [
   coHistory: (cotBool, csBuffer),
   coIgnoreCase: (cotRegexCase, csSearch),
   coImageMode: (cotImageModeAuto, csDisplay),
+  coImagePreview: (cotBool, csDisplay),
   coImages: (cotBool, csBuffer),
   coMarkLinks: (cotBool, csBuffer),
   coMetaRefresh: (cotMetaRefresh, csBuffer),
   coNoFormatMode: (cotFormatMode, csDisplay),
   coOsc52Copy: (cotBoolAuto, csInput),
   coOsc52Primary: (cotBoolAuto, csInput),
+  coPersistentStorage: (cotBool, csBuffer),
   coRefererFrom: (cotBool, csBuffer),
+  coReshapeStats: (cotBool, csStart),
+  coScriptCache: (cotBool, csExternal),
   coScripting: (cotScriptingMode, csBuffer),
   coSetTitle: (cotBoolAuto, csDisplay),
   coShowCursorPosition: (cotBool, csStatus),
   coShowDownloadPanel: (cotBool, csExternal),
   coShowHoverLink: (cotBool, csStatus),
+  coStyleCache: (cotBool, csExternal),
   coStyling: (cotBool, csBuffer),
   coUseMouse: (cotBoolAuto, csInput),
   coViNumericPrefix: (cotBool, csInput),
@@ -356,6 +368,8 @@ const OptionMap = [
   coColumns: (cotInt32, csDisplay),
   coFormatModeDisplay: (cotFormatModeAuto, csDisplay),
   coHistorySize: (cotInt32, csExternal),
+  coJsGcThreshold: (cotInt32, csBuffer),
+  coJsMemoryLimit: (cotInt32, csBuffer),
   coLines: (cotInt32, csDisplay),
   coMaxNetConnections: (cotInt32, csNetwork),
   coMaxRedirect: (cotInt32, csNetwork),
@@ -424,7 +438,7 @@ const SiteconfOptions = {
   coCookie, coScripting, coRefererFrom, coImages, coStyling,
   coInsecureSslNoVerify, coAutofocus, coMetaRefresh, coHistory, coMarkLinks,
   coShareCookieJar, coUserStyle, coFilterCmd, coDocumentCharset, coProxy,
-  coDefaultHeaders
+  coDefaultHeaders, coJsMemoryLimit, coJsGcThreshold, coPersistentStorage
 }
 
 type
@@ -2381,7 +2395,8 @@ C-Right line.nextWord
 # boolean options that initialize to true
 const ConfigInitTrue = [
   coConsoleBuffer, coWrap, coShowDownloadPanel, coViNumericPrefix,
-  coHighlightMarks, coShowCursorPosition, coShowHoverLink, coStyling, coHistory
+  coHighlightMarks, coShowCursorPosition, coShowHoverLink, coStyling, coHistory,
+  coScriptCache, coStyleCache
 ]
 
 const ConfigInitInt32 = {
@@ -180,10 +180,35 @@ type
   InlineBox* = ref object of CSSBox
     state*: InlineBoxState
 
+  TextSegmentType* = enum
+    tstText # characters of the same width, with no break opportunity
+    tstSpace # ASCII whitespace
+    tstDash # ASCII hyphen-minus
+    tstSoftHyphen
+    tstReplacement # one character displayed as U+FFFD
+    tstSkip # characters that take up no space (marks, format chars)
+
+  # A run of characters that line breaking treats the same way.
+  TextSegment* = object
+    t*: TextSegmentType
+    w*: uint8 # width of each character in cells
+    len*: int32 # length in bytes
+    n*: int32 # number of characters
+
+  # Text of an InlineTextBox split into segments.  It only depends on the
+  # text and text-transform, so it is kept across relayouts.
+  TextSegments* = object
+    text*: RefString # text the segments were computed from
+    len*: int # text.s.len when the segments were computed
+    transform*: CSSTextTransform
+    s*: string # transformed text (empty with text-transform: none)
+    segs*: seq[TextSegment]
+
   InlineTextBox* {.final.} = ref object of InlineBox
     runs*: seq[TextRun] # state
     text*: RefString
     len*: int # must invalidate if text.s.len != len
+    segments*: TextSegments # cache
 
   InlineNewLineBox* {.final.} = ref object of InlineBox
 
@@ -16,6 +16,7 @@ import html/script
 import types/color
 import types/jscolor
 import types/opt
+import types/reshapestats
 import utils/dtoawrap
 import utils/twtstr
 
@@ -117,13 +118,10 @@ proc add(entry: var RuleListEntry; rule: CSSRuleDef) =
     entry.vals[f].add(rule.vals[f])
     entry.vars[f].add(rule.vars[f])
 
-proc calcRules(map: var RuleListMap; element: Element; sheet: CSSRuleMap;
+proc calcRules(tosorts: var ToSorts; element: Element; sheet: CSSRuleMap;
     depends: var DependencyInfo) =
   let parentElement = element.parentElement
   let quirks = element.document.mode == qmQuirks
-  var tosorts = ToSorts(
-    cache: AncestorCache(last: parentElement, quirks: sheet.quirks)
-  )
   tosorts.calcRules(element, depends, sheet.tagTable, element.localName)
   if element.id != satUempty:
     let id = if quirks: element.id.toLowerAscii() else: element.id
@@ -142,6 +140,15 @@ proc calcRules(map: var RuleListMap; element: Element; sheet: CSSRuleMap;
   if element.hint:
     tosorts.calcRules(element, depends, sheet.typeList[shtHint])
   tosorts.calcRules(element, depends, sheet.typeList[shtGeneral])
+
+proc calcRules(map: var RuleListMap; element: Element; sheet: CSSRuleMap;
+    depends: var DependencyInfo) =
+  var tosorts = ToSorts(
+    cache: AncestorCache(last: element.parentElement, quirks: sheet.quirks)
+  )
+  if sheet.ua != nil:
+    tosorts.calcRules(element, sheet.ua, depends)
+  tosorts.calcRules(element, sheet, depends)
   for pseudo, it in tosorts.map.mpairs:
     it.sort(proc(x, y: RulePair): int =
       let n = cmp(x.specificity, y.specificity)
@@ -234,10 +241,10 @@ proc applyValue(ctx: var ApplyValueContext; entry: CSSComputedEntry;
     # either already set, or reverted to a subsequent value.
     return
   case entry.et
-  of ceBit: ctx.vals.bits[t].dummy = entry.bit
-  of ceHWord: ctx.vals.hwords[t] = entry.hword
-  of ceWord: ctx.vals.words[t] = entry.word
-  of ceObject: ctx.vals.objs[t] = entry.obj
+  of ceBit: ctx.vals.setBit(t, CSSValueBit(dummy: entry.bit))
+  of ceHWord: ctx.vals.setHWord(t, entry.hword)
+  of ceWord: ctx.vals.setWord(t, entry.word)
+  of ceObject: ctx.vals.setObj(t, entry.obj)
   of ceGlobal:
     case entry.global
     of cgtInherit: ctx.vals.initialOrCopyFrom(ctx.parentComputed, t)
@@ -407,13 +414,21 @@ proc applyVars(ctx: var ApplyValueContext; vars: openArray[CSSVariable];
 
 proc applyDeclarations(rules: RuleList; pseudo: PseudoElement;
     parent, element: Element; window: Window; old: CSSValues): CSSValues =
-  result = CSSValues(pseudo: pseudo)
+  var parentComputed: CSSValues = nil
   var parentVars: CSSVariableMap = nil
-  var ctx = ApplyValueContext(window: window, vals: result, old: old)
   if parent != nil:
-    parent.ensureStyle()
-    ctx.parentComputed = parent.computed
-    parentVars = ctx.parentComputed.vars
+    parent.ensureOwnStyle()
+    parentComputed = parent.computed
+    parentVars = parentComputed.vars
+  # Start from the initial and inherited values, so that groups nothing
+  # is declared for stay shared.
+  result = newCSSValues(pseudo, parentComputed)
+  var ctx = ApplyValueContext(
+    window: window,
+    vals: result,
+    parentComputed: parentComputed,
+    old: old
+  )
   for origin in CSSOrigin:
     for layer in rules.a[origin].layers:
       ctx.applyVars(layer.vars[cifImportant], parentVars)
@@ -442,8 +457,8 @@ proc applyDeclarations(rules: RuleList; pseudo: PseudoElement;
   for t in CSSPropertyType:
     if ctx.revertMap[t] != rtSet:
       result.initialOrInheritFrom(ctx.parentComputed, t)
-    if valueType(t) == cvtColor and result.words[t].color.t == cctCurrent:
-      result.words[t].color = result{"color"}
+    if valueType(t) == cvtColor and result.getWord(t).color.t == cctCurrent:
+      result.setWord(t, CSSValueWord(color: result{"color"}))
     if old != nil and t in LayoutProperties:
       relayout = relayout or not result.equals(old, t)
   if relayout:
@@ -473,8 +488,10 @@ proc applyDeclarations(map: RuleListMap; pseudo: PseudoElement;
   map[pseudo].applyDeclarations(pseudo, parent, element, window, old)
 
 proc applyStyle(element: Element) =
+  inc reshapeStats.styled
   let document = element.document
   let window = document.window
+  let old = element.computed
   var depends = DependencyInfo.default
   var map = RuleListMap.default
   map.calcRules(element, document.getRuleMap(), depends)
@@ -509,9 +526,20 @@ proc applyStyle(element: Element) =
         pcomputed{"display"} = DisplayMarker
       computed.next = pcomputed
       computed = pcomputed
-  element.computed = element.computed.atomize()
+  let fresh = element.computed
+  element.computed = fresh.atomize()
+  if element.computed != fresh:
+    inc reshapeStats.styleShared
+  # Values are atomized, so children only have to be restyled if they
+  # may inherit something new.
+  if old != nil and old != element.computed:
+    element.restyleChildren()
+
+proc applyStyleTimed(element: Element) =
+  timeStyle:
+    element.applyStyle()
 
 # Forward declaration hack
-applyStyleImpl = applyStyle
+applyStyleImpl = applyStyleTimed
 
 {.pop.} # raises: []
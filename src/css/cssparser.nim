@@ -274,6 +274,7 @@ type
     cptOverflowX = "overflow-x"
     cptOverflowY = "overflow-y"
     cptPosition = "position"
+    cptTableLayout = "table-layout"
     cptTextAlign = "text-align"
     cptTextDecoration = "text-decoration"
     cptTextTransform = "text-transform"
@@ -973,6 +974,91 @@ proc initCSSParser*(toks: openArray[CSSToken]): CSSParser =
 proc initCSSParserSink*(toks: var seq[CSSToken]): CSSParser =
   return CSSParser(toks: move(toks))
 
+# Compact binary form of a token list, used for caching the tokens of style
+# sheets.  It is only valid for the build that wrote it.
+#
+# Each token is stored as its type, flags and dimension type (one byte
+# each), followed by the union part for the token types that use it, and
+# finally its string as a varint length and the string itself.
+proc serializeTokens*(res: var string; toks: openArray[CSSToken]) =
+  for tok in toks:
+    res &= char(tok.t)
+    res &= cast[char](tok.flags)
+    res &= char(tok.dt)
+    case tok.t
+    of cttNumber, cttPercentage, cttDimension, cttDelim:
+      let u = tok.tu.u
+      for i in 0 ..< 4:
+        res &= char((u shr (i * 8)) and 0xFF)
+    of cttFunction: res &= char(tok.ft)
+    of cttAtKeyword: res &= char(tok.at)
+    else: discard
+    var n = uint(tok.s.len)
+    while n >= 0x80:
+      res &= char((n and 0x7F) or 0x80)
+      n = n shr 7
+    res &= char(n)
+    res &= tok.s
+
+# Returns false if `iq' is not a valid token list.
+proc deserializeTokens*(iq: openArray[char]; toks: var seq[CSSToken]): bool =
+  var i = 0
+  while i < iq.len:
+    if iq.len - i < 3:
+      return false
+    let t = uint8(iq[i])
+    let flags = uint8(iq[i + 1])
+    let dt = uint8(iq[i + 2])
+    const FlagsEnd = CSSTokenFlag.high.ord + 1
+    if t > uint8(CSSTokenType.high) or flags shr FlagsEnd != 0 or
+        dt > uint8(CSSDimensionType.high):
+      return false
+    var tok = CSSToken(
+      t: CSSTokenType(t),
+      flags: cast[set[CSSTokenFlag]](flags),
+      dt: CSSDimensionType(dt)
+    )
+    i += 3
+    case tok.t
+    of cttNumber, cttPercentage, cttDimension, cttDelim:
+      if iq.len - i < 4:
+        return false
+      var u = 0u32
+      for j in 0 ..< 4:
+        u = u or (uint32(iq[i + j]) shl (j * 8))
+      tok.tu.u = u
+      i += 4
+    of cttFunction:
+      if i >= iq.len or uint8(iq[i]) > uint8(CSSFunctionType.high):
+        return false
+      tok.tu.ft = CSSFunctionType(uint8(iq[i]))
+      inc i
+    of cttAtKeyword:
+      if i >= iq.len or uint8(iq[i]) > uint8(CSSAtRuleType.high):
+        return false
+      tok.tu.at = CSSAtRuleType(uint8(iq[i]))
+      inc i
+    else: discard
+    var n = 0
+    var shift = 0
+    while true:
+      if i >= iq.len or shift > 28:
+        return false
+      let c = uint8(iq[i])
+      inc i
+      n = n or (int(c and 0x7F) shl shift)
+      if c < 0x80:
+        break
+      shift += 7
+    if n > iq.len - i:
+      return false
+    if n > 0:
+      tok.s = newString(n)
+      copyMem(addr tok.s[0], unsafeAddr iq[i], n)
+      i += n
+    toks.add(tok)
+  true
+
 proc initCSSDeclaration*(name: string): Opt[CSSDeclaration] =
   if name.startsWith("--"):
     return ok(CSSDeclaration(
@@ -39,6 +39,7 @@ import html/dom
 import types/bitmap
 import types/color
 import types/refstring
+import types/reshapestats
 import utils/twtstr
 
 type
@@ -79,6 +80,8 @@ type
     absoluteTail: CSSAbsolute
     fixedHead: CSSAbsolute
     fixedTail: CSSAbsolute
+    # Empty children seqs of finished frames, reused by the next ones.
+    childrenPool: seq[seq[StyledNode]]
 
   TreeFrame = object
     parent: Element
@@ -167,6 +170,10 @@ proc initTreeFrame(ctx: TreeContext; parent: Element; computed: CSSValues):
     pseudoComputed: computed.next,
     ctx: ctx
   )
+  inc reshapeStats.frames
+  if ctx.childrenPool.len > 0:
+    result.children = ctx.childrenPool.pop()
+    inc reshapeStats.framesReused
 
 proc getAnonInlineComputed(frame: var TreeFrame): CSSValues =
   if frame.anonInlineComputed == nil:
@@ -356,7 +363,7 @@ proc addAnon(frame: var TreeFrame; computed: CSSValues;
   frame.add(initStyledAnon(frame.parent, computed, children))
 
 proc addElement(frame: var TreeFrame; element: Element) =
-  element.ensureStyle()
+  element.ensureOwnStyle()
   if frame.displayed(element):
     frame.add(StyledNode(
       t: stElement,
@@ -746,6 +753,8 @@ proc buildOuterBox(ctx: TreeContext; cached: CSSBox; styledNode: StyledNode;
       stackItem = ctx.pushStackItem(styledNode)
   frame.buildChildren(styledNode)
   let box = ctx.buildInnerBox(frame, cached, styledNode)
+  frame.children.setLen(0)
+  ctx.childrenPool.add(move(frame.children))
   if styledNode.t == stElement:
     box.element.box = box
   ctx.resetCounters(styledNode.element, countersLen, oldCountersLen,
@@ -45,6 +45,7 @@ type
     cvtOverflow = "overflow"
     cvtPosition = "position"
     cvtQuotes = "quotes"
+    cvtTableLayout = "tableLayout"
     cvtTextAlign = "textAlign"
     cvtTextDecoration = "textDecoration"
     cvtTextTransform = "textTransform"
@@ -182,6 +183,10 @@ type
     BorderCollapseSeparate = "separate"
     BorderCollapseCollapse = "collapse"
 
+  CSSTableLayout* = enum
+    TableLayoutAuto = "auto"
+    TableLayoutFixed = "fixed"
+
   CSSContentType* = enum
     ContentString = "-cha-string"
     ContentCounter = "-cha-counter"
@@ -256,6 +261,138 @@ type
     BorderStyleHash = "-cha-hash"
     BorderStylePeriod = "-cha-period"
 
+  CSSPropertyReprType* = enum
+    cprtBit, cprtHWord, cprtWord, cprtObject
+
+  # Properties are stored in groups, which are shared between CSSValues
+  # objects and copied on write (like style structs in Gecko).  A style
+  # that differs from another in a single margin only needs a new spacing
+  # group; the rest is shared.
+  CSSPropertyGroup = enum
+    cpgInherited # exactly the inherited properties
+    cpgBox # display, positioning scheme, flex items
+    cpgSize # width, height and offsets
+    cpgSpacing # margin and padding
+    cpgBorder
+    cpgBackground
+    cpgContent # generated content and counters
+
+proc reprType*(t: CSSPropertyType): CSSPropertyReprType =
+  if t <= LastBitPropType:
+    return cprtBit
+  if t <= LastHWordPropType:
+    return cprtHWord
+  if t <= LastWordPropType:
+    return cprtWord
+  return cprtObject
+
+const PropertyGroups = [
+  # bits
+  cptBgcolorIsCanvas: cpgBackground,
+  cptBorderBottomStyle: cpgBorder,
+  cptBorderCollapse: cpgInherited,
+  cptBorderLeftStyle: cpgBorder,
+  cptBorderRightStyle: cpgBorder,
+  cptBorderTopStyle: cpgBorder,
+  cptBoxSizing: cpgBox,
+  cptCaptionSide: cpgInherited,
+  cptClear: cpgBox,
+  cptDisplay: cpgBox,
+  cptFlexDirection: cpgBox,
+  cptFlexWrap: cpgBox,
+  cptFloat: cpgBox,
+  cptFontStyle: cpgInherited,
+  cptListStylePosition: cpgInherited,
+  cptListStyleType: cpgInherited,
+  cptOverflowX: cpgBox,
+  cptOverflowY: cpgBox,
+  cptPosition: cpgBox,
+  cptTableLayout: cpgBox,
+  cptTextAlign: cpgInherited,
+  cptTextDecoration: cpgInherited,
+  cptTextTransform: cpgInherited,
+  cptVerticalAlign: cpgBox,
+  cptVisibility: cpgInherited,
+  cptWhiteSpace: cpgInherited,
+  cptWordBreak: cpgInherited,
+
+  # half-words
+  cptBorderBottomWidth: cpgBorder,
+  cptBorderLeftWidth: cpgBorder,
+  cptBorderRightWidth: cpgBorder,
+  cptBorderTopWidth: cpgBorder,
+  cptChaColspan: cpgBox,
+  cptChaRowspan: cpgBox,
+  cptFlexGrow: cpgBox,
+  cptFlexShrink: cpgBox,
+  cptFontWeight: cpgInherited,
+  cptInputIntrinsicSize: cpgBox,
+  cptOpacity: cpgBackground,
+
+  # words
+  cptBackgroundColor: cpgBackground,
+  cptBorderBottomColor: cpgBorder,
+  cptBorderLeftColor: cpgBorder,
+  cptBorderRightColor: cpgBorder,
+  cptBorderSpacingBlock: cpgInherited,
+  cptBorderSpacingInline: cpgInherited,
+  cptBorderTopColor: cpgBorder,
+  cptBottom: cpgSize,
+  cptColor: cpgInherited,
+  cptFlexBasis: cpgBox,
+  cptFontSize: cpgBox,
+  cptHeight: cpgSize,
+  cptLeft: cpgSize,
+  cptMarginBottom: cpgSpacing,
+  cptMarginLeft: cpgSpacing,
+  cptMarginRight: cpgSpacing,
+  cptMarginTop: cpgSpacing,
+  cptMaxHeight: cpgSize,
+  cptMaxWidth: cpgSize,
+  cptMinHeight: cpgSize,
+  cptMinWidth: cpgSize,
+  cptPaddingBottom: cpgSpacing,
+  cptPaddingLeft: cpgSpacing,
+  cptPaddingRight: cpgSpacing,
+  cptPaddingTop: cpgSpacing,
+  cptRight: cpgSize,
+  cptTop: cpgSize,
+  cptVerticalAlignLength: cpgBox,
+  cptWidth: cpgSize,
+  cptZIndex: cpgBox,
+
+  # pointers
+  cptBackgroundImage: cpgBackground,
+  cptContent: cpgContent,
+  cptCounterReset: cpgContent,
+  cptCounterIncrement: cpgContent,
+  cptCounterSet: cpgContent,
+  cptQuotes: cpgInherited,
+]
+
+# Index of each property in its group's array of its representation.
+proc getPropertySlots(): array[CSSPropertyType, uint8] =
+  result = default(array[CSSPropertyType, uint8])
+  var counts = default(array[CSSPropertyGroup,
+    array[CSSPropertyReprType, uint8]])
+  for t in CSSPropertyType:
+    let g = PropertyGroups[t]
+    let r = t.reprType
+    result[t] = counts[g][r]
+    inc counts[g][r]
+
+const PropertySlots = getPropertySlots()
+
+# Number of slots in the arrays of a group; all groups have the same
+# layout, so this is the largest count of any group.
+proc getGroupSizes(): array[CSSPropertyReprType, int] =
+  result = default(array[CSSPropertyReprType, int])
+  for t in CSSPropertyType:
+    let r = t.reprType
+    result[r] = max(result[r], int(PropertySlots[t]) + 1)
+
+const GroupSizes = getGroupSizes()
+
 type
   # CSSLength may represent:
   # * if isNaN(px) and isNaN(perc), the ident "auto"
@@ -303,6 +440,7 @@ type
     listStyleType*: CSSListStyleType
     overflow*: CSSOverflow
     position*: CSSPosition
+    tableLayout*: CSSTableLayout
     textAlign*: CSSTextAlign
     textDecoration*: set[CSSTextDecoration]
     textTransform*: CSSTextTransform
@@ -341,26 +479,36 @@ type
     tab: seq[CSSVariable]
     load: int
 
-  # Hash map for all existing CSSValues in the document.
+  # Hash map for all existing CSSValues and property groups in the
+  # document.
   # New CSSValues objects are checked for an exact match; if there is one,
-  # the old one is used (and the new one dropped).
-  #TODO: we could split up CSSValues into smaller parts and intern those
-  # too for more savings.
+  # the old one is used (and the new one dropped).  The same goes for
+  # their groups.
   CSSValuesMapObj* = object
     tab: seq[ptr CSSValuesRootObj]
     load: int
 
   CSSValuesRootObj {.pure, inheritable.} = object
     hcache: Hash
+    isGroup: bool
 
   CSSValuesRoot = ref CSSValuesRootObj
 
+  CSSValueGroupObj {.pure.} = object of CSSValuesRoot
+    # Set once the group may be referenced by more than one CSSValues;
+    # from then on, it must be copied before it is modified.
+    shared: bool
+    atomized: bool
+    bits: array[GroupSizes[cprtBit], CSSValueBit]
+    hwords: array[GroupSizes[cprtHWord], CSSValueHWord]
+    words: array[GroupSizes[cprtWord], CSSValueWord]
+    objs: array[GroupSizes[cprtObject], CSSValue]
+
+  CSSValueGroup = ref CSSValueGroupObj
+
   CSSValuesObj* {.pure.} = object of CSSValuesRoot
     pseudo*: PseudoElement
-    bits*: array[CSSPropertyType.low..LastBitPropType, CSSValueBit]
-    hwords*: array[FirstHWordPropType..LastHWordPropType, CSSValueHWord]
-    words*: array[FirstWordPropType..LastWordPropType, CSSValueWord]
-    objs*: array[FirstObjPropType..CSSPropertyType.high, CSSValue]
+    groups: array[CSSPropertyGroup, CSSValueGroup]
     vars*: CSSVariableMap
     next*: CSSValues
 
@@ -489,6 +637,7 @@ const ValueTypes = [
   cptOverflowX: cvtOverflow,
   cptOverflowY: cvtOverflow,
   cptPosition: cvtPosition,
+  cptTableLayout: cvtTableLayout,
   cptTextAlign: cvtTextAlign,
   cptTextDecoration: cvtTextDecoration,
   cptTextTransform: cvtTextTransform,
@@ -558,6 +707,11 @@ const InheritedProperties = {
   cptBorderCollapse, cptQuotes, cptVisibility, cptTextTransform
 }
 
+static:
+  # inheritProperties shares the whole inherited group of the parent
+  for t in CSSPropertyType:
+    doAssert (PropertyGroups[t] == cpgInherited) == (t in InheritedProperties)
+
 const OverflowScrollLike* = {OverflowScroll, OverflowAuto, OverflowOverlay}
 const OverflowHiddenLike* = {OverflowHidden, OverflowClip}
 const FlexReverse* = {FlexDirectionRowReverse, FlexDirectionColumnReverse}
@@ -621,13 +775,10 @@ const LayoutProperties* = {
   cptMinWidth, cptMinHeight, cptMaxWidth, cptMaxHeight,
   cptChaColspan, cptChaRowspan, cptVisibility, # collapse affects tables
   cptBorderCollapse, cptBorderSpacingInline, cptBorderSpacingBlock,
-  cptCaptionSide, cptPosition
+  cptCaptionSide, cptPosition, cptTableLayout
 }
 
-proc isSame(a, b: CSSValues): bool =
-  if a.hcache != b.hcache or a.pseudo != b.pseudo or a.vars != b.vars or
-      a.next != b.next:
-    return false
+proc isSame(a, b: CSSValueGroup): bool =
   if cmpMem(addr a.bits, addr b.bits, sizeof(a.bits)) != 0:
     return false
   if cmpMem(addr a.hwords, addr b.hwords, sizeof(a.hwords)) != 0:
@@ -638,6 +789,19 @@ proc isSame(a, b: CSSValues): bool =
     return false
   true
 
+# Groups are atomized before the values that hold them, so comparing
+# the pointers is enough.
+proc isSame(a, b: CSSValues): bool =
+  a.pseudo == b.pseudo and a.vars == b.vars and a.next == b.next and
+    a.groups == b.groups
+
+proc isSame(a, b: ptr CSSValuesRootObj): bool =
+  if a.hcache != b.hcache or a.isGroup != b.isGroup:
+    return false
+  if a.isGroup:
+    return cast[CSSValueGroup](a).isSame(cast[CSSValueGroup](b))
+  cast[CSSValues](a).isSame(cast[CSSValues](b))
+
 proc putAgain(map: var CSSValuesMapObj; computed: ptr CSSValuesRootObj) =
   let mask = map.tab.len - 1
   var home = computed.hcache and mask
@@ -665,14 +829,40 @@ proc put0(map: var CSSValuesMapObj; computed: ptr CSSValuesRootObj):
       break
     # if current was swapped out, then it cannot be in the table (otherwise
     # the other instance would come earlier)
-    if current == computed and
-        cast[CSSValues](current).isSame(cast[CSSValues](it)):
+    if current == computed and current.isSame(it):
       return it # already added (for tags)
     if tabSwap(home, it.hcache, i, mask): # displace
       swap(map.tab[i], current)
     i = (i + 1) and mask
   computed
 
+proc put(map: var CSSValuesMapObj; computed: ptr CSSValuesRootObj):
+    ptr CSSValuesRootObj =
+  for it in map.tab.prepareTableAdd(map.load, 32):
+    if it != nil:
+      map.putAgain(it)
+  result = map.put0(computed)
+  if result == computed:
+    inc map.load
+
+proc atomize(map: var CSSValuesMapObj; group: CSSValueGroup): CSSValueGroup =
+  if group.atomized:
+    return group
+  var h: Hash = 0
+  for it in group.bits:
+    h = h !& int(it.dummy)
+  for it in group.hwords:
+    h = h !& cast[int](it.dummy)
+  for it in group.words:
+    h = h !& cast[int](it.dummy)
+  for it in group.objs:
+    h = h !& cast[int](it)
+  group.hcache = !$h
+  let res = cast[CSSValueGroup](map.put(cast[ptr CSSValuesRootObj](group)))
+  res.atomized = true
+  res.shared = true
+  res
+
 # If an equivalent computed is in map, return that.
 # Otherwise, insert computed into map.
 proc atomize(map: var CSSValuesMapObj; computed: CSSValues): CSSValues =
@@ -684,22 +874,11 @@ proc atomize(map: var CSSValuesMapObj; computed: CSSValues): CSSValues =
   h = h !& int(computed.pseudo)
   h = h !& cast[int](computed.vars)
   h = h !& cast[int](computed.next)
-  for it in computed.bits:
-    h = h !& int(it.dummy)
-  for it in computed.hwords:
-    h = h !& cast[int](it.dummy)
-  for it in computed.words:
-    h = h !& cast[int](it.dummy)
-  for it in computed.objs:
+  for it in computed.groups.mitems:
+    it = map.atomize(it)
     h = h !& cast[int](it)
   computed.hcache = !$h
-  for it in map.tab.prepareTableAdd(map.load, 32):
-    if it != nil:
-      map.putAgain(it)
-  let res = map.put0(cast[ptr CSSValuesRootObj](computed))
-  if res == cast[ptr CSSValuesRootObj](computed):
-    inc map.load
-  cast[CSSValues](res)
+  cast[CSSValues](map.put(cast[ptr CSSValuesRootObj](computed)))
 
 proc atomize*(computed: CSSValues): CSSValues =
   computedMap.atomize(computed)
@@ -771,18 +950,6 @@ proc putIfAbsent*(map: CSSVariableMap; cvar: CSSVariable) =
 proc isSame*(map, other: CSSVariableMap): bool =
   other != nil and map.load == other.load and map.tab == other.tab
 
-type CSSPropertyReprType* = enum
-  cprtBit, cprtHWord, cprtWord, cprtObject
-
-proc reprType*(t: CSSPropertyType): CSSPropertyReprType =
-  if t <= LastBitPropType:
-    return cprtBit
-  if t <= LastHWordPropType:
-    return cprtHWord
-  if t <= LastWordPropType:
-    return cprtWord
-  return cprtObject
-
 proc valueType*(prop: CSSPropertyType): CSSValueType =
   return ValueTypes[prop]
 
@@ -903,6 +1070,7 @@ proc serialize(val: CSSValueBit; t: CSSValueType): string =
   of cvtBorderStyle: return $val.borderStyle
   of cvtBoxSizing: return $val.boxSizing
   of cvtCaptionSide: return $val.captionSide
+  of cvtTableLayout: return $val.tableLayout
   of cvtClear: return $val.clear
   of cvtDisplay: return $val.display
   of cvtFlexDirection: return $val.flexDirection
@@ -924,12 +1092,62 @@ proc serialize(val: CSSValueBit; t: CSSValueType): string =
     assert false
     return ""
 
+template group(vals: CSSValues; t: CSSPropertyType): CSSValueGroup =
+  vals.groups[PropertyGroups[t]]
+
+proc getBit*(vals: CSSValues; t: CSSPropertyType): CSSValueBit =
+  vals.group(t).bits[PropertySlots[t]]
+
+proc getHWord*(vals: CSSValues; t: CSSPropertyType): CSSValueHWord =
+  vals.group(t).hwords[PropertySlots[t]]
+
+proc getWord*(vals: CSSValues; t: CSSPropertyType): CSSValueWord =
+  vals.group(t).words[PropertySlots[t]]
+
+proc getObj*(vals: CSSValues; t: CSSPropertyType): CSSValue =
+  vals.group(t).objs[PropertySlots[t]]
+
+# Return the group of t for modification, copying it first if it is
+# shared.
+proc mgroup(vals: CSSValues; t: CSSPropertyType): CSSValueGroup =
+  let g = PropertyGroups[t]
+  let group = vals.groups[g]
+  if not group.shared:
+    return group
+  let copy = CSSValueGroup(
+    isGroup: true,
+    bits: group.bits,
+    hwords: group.hwords,
+    words: group.words,
+    objs: group.objs
+  )
+  vals.groups[g] = copy
+  copy
+
+# The setters skip values that are already set, so that groups are only
+# copied if something really changes.
+proc setBit*(vals: CSSValues; t: CSSPropertyType; val: CSSValueBit) =
+  if vals.getBit(t).dummy != val.dummy:
+    vals.mgroup(t).bits[PropertySlots[t]] = val
+
+proc setHWord*(vals: CSSValues; t: CSSPropertyType; val: CSSValueHWord) =
+  if vals.getHWord(t).dummy != val.dummy:
+    vals.mgroup(t).hwords[PropertySlots[t]] = val
+
+proc setWord*(vals: CSSValues; t: CSSPropertyType; val: CSSValueWord) =
+  if vals.getWord(t).dummy != val.dummy:
+    vals.mgroup(t).words[PropertySlots[t]] = val
+
+proc setObj*(vals: CSSValues; t: CSSPropertyType; val: CSSValue) =
+  if vals.getObj(t) != val:
+    vals.mgroup(t).objs[PropertySlots[t]] = val
+
 proc serialize*(computed: CSSValues; p: CSSPropertyType): string =
   case p.reprType
-  of cprtBit: return computed.bits[p].serialize(valueType(p))
-  of cprtHWord: return computed.hwords[p].serialize(valueType(p))
-  of cprtWord: return computed.words[p].serialize(valueType(p))
-  of cprtObject: return computed.objs[p].serialize()
+  of cprtBit: return computed.getBit(p).serialize(valueType(p))
+  of cprtHWord: return computed.getHWord(p).serialize(valueType(p))
+  of cprtWord: return computed.getWord(p).serialize(valueType(p))
+  of cprtObject: return computed.getObj(p).serialize()
 
 proc `$`*(computed: CSSValues): string =
   result = ""
@@ -941,7 +1159,7 @@ proc `$`*(computed: CSSValues): string =
       continue
     result &= $p & ':'
     if p == cptVerticalAlign:
-      if computed.bits[p].verticalAlign == VerticalAlignLength:
+      if computed.getBit(p).verticalAlign == VerticalAlignLength:
         result &= computed.serialize(cptVerticalAlignLength)
         result &= ';'
         continue
@@ -956,13 +1174,13 @@ when defined(debug):
     return val.serialize()
 
 proc getLength*(vals: CSSValues; p: CSSPropertyType): CSSLength =
-  return vals.words[p].length
+  return vals.getWord(p).length
 
 proc getLineWidth*(vals: CSSValues; p: CSSPropertyType): float32 =
-  return vals.hwords[p].lineWidth
+  return vals.getHWord(p).lineWidth
 
 proc getBorderStyle*(vals: CSSValues; p: CSSPropertyType): CSSBorderStyle =
-  return vals.bits[p].borderStyle
+  return vals.getBit(p).borderStyle
 
 macro `{}`*(vals: CSSValues; s: static string): untyped =
   let t = propertyType(s).get
@@ -970,16 +1188,16 @@ macro `{}`*(vals: CSSValues; s: static string): untyped =
   case t.reprType
   of cprtBit:
     return quote do:
-      `vals`.bits[CSSPropertyType(`t`)].`vs`
+      `vals`.getBit(CSSPropertyType(`t`)).`vs`
   of cprtHWord:
     return quote do:
-      `vals`.hwords[CSSPropertyType(`t`)].`vs`
+      `vals`.getHWord(CSSPropertyType(`t`)).`vs`
   of cprtWord:
     return quote do:
-      `vals`.words[CSSPropertyType(`t`)].`vs`
+      `vals`.getWord(CSSPropertyType(`t`)).`vs`
   of cprtObject:
     return quote do:
-      `vals`.objs[CSSPropertyType(`t`)].`vs`
+      `vals`.getObj(CSSPropertyType(`t`)).`vs`
 
 macro `{}=`*(vals: CSSValues; s: static string, val: typed) =
   let t = propertyType(s).get
@@ -988,19 +1206,19 @@ macro `{}=`*(vals: CSSValues; s: static string, val: typed) =
   case t.reprType
   of cprtBit:
     return quote do:
-      `vals`.bits[CSSPropertyType(`t`)] = CSSValueBit(`vs`: `val`)
+      `vals`.setBit(CSSPropertyType(`t`), CSSValueBit(`vs`: `val`))
   of cprtHWord:
     return quote do:
-      `vals`.hwords[CSSPropertyType(`t`)] = CSSValueHWord(`vs`: `val`)
+      `vals`.setHWord(CSSPropertyType(`t`), CSSValueHWord(`vs`: `val`))
   of cprtWord:
     return quote do:
-      `vals`.words[CSSPropertyType(`t`)] = CSSValueWord(`vs`: `val`)
+      `vals`.setWord(CSSPropertyType(`t`), CSSValueWord(`vs`: `val`))
   of cprtObject:
     return quote do:
-      `vals`.objs[CSSPropertyType(`t`)] = CSSValue(
+      `vals`.setObj(CSSPropertyType(`t`), CSSValue(
         v: CSSValueType(`v`),
         `vs`: `val`
-      )
+      ))
 
 proc inherited*(t: CSSPropertyType): bool =
   return t in InheritedProperties
@@ -2074,6 +2292,7 @@ proc parseValue(ctx: var CSSParser; t: CSSPropertyType;
   of cvtPosition: makeEntry(t, ?parseIdent[CSSPosition](ctx))
   of cvtCaptionSide: makeEntry(t, ?parseIdent[CSSCaptionSide](ctx))
   of cvtBorderCollapse: makeEntry(t, ?parseIdent[CSSBorderCollapse](ctx))
+  of cvtTableLayout: makeEntry(t, ?parseIdent[CSSTableLayout](ctx))
   of cvtBorderStyle: makeEntry(t, ?parseIdent[CSSBorderStyle](ctx))
   of cvtQuotes: makeEntry(t, CSSValue(v: v, quotes: ?ctx.parseQuotes()))
   of cvtCounterSet:
@@ -2525,34 +2744,45 @@ proc parseComputedValues*(res: var seq[CSSComputedEntry];
 
 proc copyFrom*(a, b: CSSValues; t: CSSPropertyType) =
   case t.reprType
-  of cprtBit: a.bits[t] = b.bits[t]
-  of cprtHWord: a.hwords[t] = b.hwords[t]
-  of cprtWord: a.words[t] = b.words[t]
-  of cprtObject: a.objs[t] = b.objs[t]
+  of cprtBit: a.setBit(t, b.getBit(t))
+  of cprtHWord: a.setHWord(t, b.getHWord(t))
+  of cprtWord: a.setWord(t, b.getWord(t))
+  of cprtObject: a.setObj(t, b.getObj(t))
 
 proc setInitial*(a: CSSValues; t: CSSPropertyType) =
   case t.reprType
-  of cprtBit: a.bits[t].dummy = 0
-  of cprtHWord: a.hwords[t] = getDefaultHWord(t)
-  of cprtWord: a.words[t] = getDefaultWord(t)
-  of cprtObject: a.objs[t] = getDefault(t)
+  of cprtBit: a.setBit(t, CSSValueBit(dummy: 0))
+  of cprtHWord: a.setHWord(t, getDefaultHWord(t))
+  of cprtWord: a.setWord(t, getDefaultWord(t))
+  of cprtObject: a.setObj(t, getDefault(t))
+
+proc getInitialGroups(): array[CSSPropertyGroup, CSSValueGroup] =
+  for it in result.mitems:
+    it = CSSValueGroup(isGroup: true)
+  for t in CSSPropertyType:
+    let group = result[PropertyGroups[t]]
+    let i = PropertySlots[t]
+    case t.reprType
+    of cprtBit: group.bits[i].dummy = 0
+    of cprtHWord: group.hwords[i] = getDefaultHWord(t)
+    of cprtWord: group.words[i] = getDefaultWord(t)
+    of cprtObject: group.objs[i] = getDefault(t)
+  for it in result.mitems:
+    it = computedMap.atomize(it)
+
+let initialGroups = getInitialGroups()
 
 proc setAllInitial*(a: CSSValues) =
-  for it in a.bits.mitems:
-    it.dummy = 0
-  for t, it in a.hwords.mpairs:
-    it = getDefaultHWord(t)
-  for t, it in a.words.mpairs:
-    it = getDefaultWord(t)
-  for t, it in a.objs.mpairs:
-    it = getDefault(t)
+  a.groups = initialGroups
 
 # Note: this doesn't work with objects (it doesn't have to.)
 proc equals*(a, b: CSSValues; t: CSSPropertyType): bool =
+  if a.group(t) == b.group(t):
+    return true
   return case t.reprType
-  of cprtBit: a.bits[t].dummy == b.bits[t].dummy
-  of cprtHWord: a.hwords[t].dummy == b.hwords[t].dummy
-  of cprtWord: a.words[t].dummy == b.words[t].dummy
+  of cprtBit: a.getBit(t).dummy == b.getBit(t).dummy
+  of cprtHWord: a.getHWord(t).dummy == b.getHWord(t).dummy
+  of cprtWord: a.getWord(t).dummy == b.getWord(t).dummy
   of cprtObject: false
 
 proc initialOrInheritFrom*(a, b: CSSValues; t: CSSPropertyType) =
@@ -2567,27 +2797,32 @@ proc initialOrCopyFrom*(a, b: CSSValues; t: CSSPropertyType) =
   else:
     a.setInitial(t)
 
+# Return values with all properties set to their initial value, except
+# for the inherited ones, which are taken from parent if it is not nil.
+proc newCSSValues*(pseudo: PseudoElement; parent: CSSValues): CSSValues =
+  result = CSSValues(pseudo: pseudo, groups: initialGroups)
+  if parent != nil:
+    let group = parent.groups[cpgInherited]
+    group.shared = true
+    result.groups[cpgInherited] = group
+
 proc inheritProperties*(parent: CSSValues): CSSValues =
-  result = CSSValues()
-  for t in CSSPropertyType:
-    if t.inherited:
-      result.copyFrom(parent, t)
-    else:
-      result.setInitial(t)
+  return newCSSValues(peNone, parent)
 
 proc copyProperties*(props: CSSValues): CSSValues =
+  for group in props.groups:
+    group.shared = true
   result = CSSValues()
   result[] = props[]
 
 proc rootProperties*(): CSSValues =
-  result = CSSValues()
-  result.setAllInitial()
+  return newCSSValues(peNone, nil)
 
 # Separate CSSValues of a table into those of the wrapper and the actual
 # table.
 proc splitTable*(computed: CSSValues): tuple[outer, innner: CSSValues] =
-  var outer = CSSValues()
-  var inner = CSSValues()
+  let outer = rootProperties()
+  let inner = rootProperties()
   const props = {
     cptPosition, cptFloat, cptMarginLeft, cptMarginRight, cptMarginTop,
     cptMarginBottom, cptTop, cptRight, cptBottom, cptLeft,
@@ -10,6 +10,7 @@ import css/cssparser
 import css/cssvalues
 import css/lunit
 import types/bitmap
+import types/reshapestats
 import types/winattrs
 import utils/luwrap
 import utils/strwidth
@@ -21,6 +22,17 @@ type
     cellSize: Size # size(w = attrs.ppc, h = attrs.ppl)
     canvasSize: Size # size of canvas
     luctx: LUContext
+    atomPool: InlineAtom # atoms of finished lines, linked through next
+
+  InlineAtom = ref object
+    ibox: InlineBox
+    box: BlockBox
+    run: TextRun
+    offset: Offset
+    size: Size
+    absolutes: seq[BlockBox]
+    iboxStack: seq[InlineBox] # track parent inlines to flush
+    next: InlineAtom
 
 const DefaultSpan = Span(start: 0'lu, send: LUnit.high)
 
@@ -193,7 +205,7 @@ proc applySize(box: BlockBox; input: LayoutInput; maxChildSize: Size;
 proc applyIntr(box: BlockBox; input: LayoutInput; intr: Size) =
   for dim in DimensionType:
     const pt = [dtHorizontal: cptOverflowX, dtVertical: cptOverflowY]
-    if box.computed.bits[pt[dim]].overflow notin OverflowScrollLike:
+    if box.computed.getBit(pt[dim]).overflow notin OverflowScrollLike:
       box.state.intr[dim] = intr[dim].minClamp(input.bounds.mi[dim])
     else:
       # We do not have a scroll bar, so do the next best thing: expand the
@@ -812,16 +824,6 @@ type
     intrWidth: LUnit # intrinsic size of currently processed word segment
     hasSoftHyphen: bool
 
-  InlineAtom = ref object
-    ibox: InlineBox
-    box: BlockBox
-    run: TextRun
-    offset: Offset
-    size: Size
-    absolutes: seq[BlockBox]
-    iboxStack: seq[InlineBox] # track parent inlines to flush
-    next: InlineAtom
-
   FlowState = object
     lctx: LayoutContext
     box: BlockBox
@@ -869,6 +871,31 @@ template cellSize(fstate: FlowState): Size =
 template computed(fstate: FlowState): CSSValues =
   fstate.box.computed
 
+# Atoms only live until their line is finished, so we keep them in a free
+# list and reuse them for later lines of the same layout pass.
+proc newAtom(lctx: LayoutContext; ibox: InlineBox; size: Size;
+    run: TextRun = nil; box: BlockBox = nil): InlineAtom =
+  let atom = lctx.atomPool
+  if atom == nil:
+    inc reshapeStats.atoms
+    return InlineAtom(ibox: ibox, box: box, run: run, size: size)
+  inc reshapeStats.atomsReused
+  lctx.atomPool = atom.next
+  atom.ibox = ibox
+  atom.box = box
+  atom.run = run
+  atom.offset = offset(x = 0'lu, y = 0'lu)
+  atom.size = size
+  atom.absolutes.setLen(0)
+  atom.iboxStack.setLen(0)
+  atom.next = nil
+  return atom
+
+proc freeAtoms(lctx: LayoutContext; head, tail: InlineAtom) =
+  if tail != nil:
+    tail.next = lctx.atomPool
+    lctx.atomPool = head
+
 proc realAtomsTail(lbstate: LineBoxState): InlineAtom =
   if lbstate.nowrapTail != nil:
     return lbstate.nowrapTail
@@ -1272,11 +1299,7 @@ proc mergeSpace(fstate: var FlowState; ibox: InlineTextBox): InlineAtom =
   let cellHeight = fstate.cellSize.h
   let run = TextRun()
   ibox.runs.add(run)
-  let atom = InlineAtom(
-    ibox: ibox,
-    size: size(w = 0'lu, h = cellHeight),
-    run: run
-  )
+  let atom = fstate.lctx.newAtom(ibox, size(w = 0'lu, h = cellHeight), run)
   fstate.putAtom(atom, takeAbsolutes = false)
   return atom
 
@@ -1393,6 +1416,8 @@ proc finishLine(fstate: var FlowState; ibox: InlineBox; wrap: bool;
   # Reinit in both cases.
   fstate.totalFloatWidth = max(fstate.totalFloatWidth,
     fstate.lbstate.totalFloatWidth)
+  fstate.lctx.freeAtoms(fstate.lbstate.atomsHead, fstate.lbstate.atomsTail)
+  fstate.lctx.freeAtoms(fstate.lbstate.nowrapHead, fstate.lbstate.nowrapTail)
   fstate.lbstate = fstate.initLineBoxState()
 
 proc shouldWrap0(lbstate: LineBoxState; w: LUnit): bool =
@@ -1480,7 +1505,7 @@ proc addWord(fstate: var FlowState; word: var WordState): bool =
     let size = size(w = word.width, h = fstate.cellSize.h)
     let run = TextRun(s: move(word.s))
     ibox.runs.add(run)
-    fstate.putAtom(InlineAtom(ibox: ibox, run: run, size: size))
+    fstate.putAtom(fstate.lctx.newAtom(ibox, size, run))
   word = fstate.initWord(ibox)
   return wrapped
 
@@ -1501,8 +1526,7 @@ proc addWordEOL(fstate: var FlowState; word: var WordState): bool =
     return wrapped
   return fstate.addWord(word)
 
-proc checkWrap(fstate: var FlowState; word: var WordState; u: uint32;
-    uw: int) =
+proc checkWrap(fstate: var FlowState; word: var WordState; uw: int) =
   let ibox = word.ibox
   if ibox.computed.nowrap:
     return
@@ -1584,70 +1608,132 @@ proc addWrapPos(fstate: var FlowState; word: var WordState) =
   fstate.flushIntrSize(word)
   word.wrapPos = word.s.len
 
-proc layoutTextLoop(fstate: var FlowState; ibox: InlineTextBox; s: string) =
-  var word = fstate.initWord(ibox)
-  let luctx = fstate.lctx.luctx
+proc addSegment(segs: var seq[TextSegment]; t: TextSegmentType;
+    w, len, n: int) =
+  if segs.len > 0 and t in {tstText, tstSpace, tstSkip} and
+      segs[^1].t == t and int(segs[^1].w) == w:
+    segs[^1].len += int32(len)
+    segs[^1].n += int32(n)
+  else:
+    segs.add(TextSegment(t: t, w: uint8(w), len: int32(len), n: int32(n)))
+
+proc segmentText(luctx: LUContext; s: string): seq[TextSegment] =
+  result = @[]
   var i = 0
   while i < s.len:
     let pi = i
-    var u = s.nextUTF8(i)
+    let u = s.nextUTF8(i)
     if u < 0x80:
       let c = char(u)
       if c in AsciiWhitespace:
-        fstate.processWhitespace(word, c)
+        result.addSegment(tstSpace, 1, 1, 1)
+      elif c == '-': # ascii dash
+        result.addSegment(tstDash, 1, 1, 1)
       else:
         let w = u.width()
-        fstate.checkWrap(word, u, w)
-        word.s &= c
-        let cw = w.toLUnit() * fstate.cellSize.w
-        word.width += cw
-        word.intrWidth += cw
-        fstate.lbstate.charwidth += w
-        if c == '-': # ascii dash
-          fstate.addWrapPos(word)
-          word.hasSoftHyphen = false # override soft hyphen
+        if w == 1: # take the rest of the run too
+          i = s.skipAsciiWord(i)
+        result.addSegment(tstText, w, i - pi, i - pi)
     elif luctx.isEnclosingMark(u) or luctx.isNonspacingMark(u) or
         luctx.isFormat(u):
-      continue
+      result.addSegment(tstSkip, 0, i - pi, 1)
     elif u == 0xAD: # soft hyphen
+      result.addSegment(tstSoftHyphen, 0, i - pi, 1)
+    elif u in 0xD800'u32 .. 0xDFFF'u32 or u in TabPUARange:
+      # filter out surrogates & chars placed in our PUA range
+      result.addSegment(tstReplacement, 0xFFFD'u32.width(), i - pi, 1)
+    else:
+      result.addSegment(tstText, u.width(), i - pi, 1)
+
+proc addChars(fstate: var FlowState; word: var WordState; s: openArray[char];
+    w: int) =
+  word.s &= s
+  let cw = w.toLUnit() * fstate.cellSize.w
+  word.width += cw
+  word.intrWidth += cw
+  fstate.lbstate.charwidth += w
+
+proc layoutTextLoop(fstate: var FlowState; ibox: InlineTextBox; s: string;
+    segs: openArray[TextSegment]) =
+  var word = fstate.initWord(ibox)
+  let nowrap = ibox.computed.nowrap
+  let normal = ibox.computed{"word-break"} == WordBreakNormal
+  var i = 0
+  for seg in segs:
+    let e = i + int(seg.len)
+    let w = int(seg.w)
+    case seg.t
+    of tstText:
+      # Without a wrap opportunity, checkWrap does nothing for the rest of
+      # a run of characters that are not double width, so we can add them
+      # in one go.
+      let bulk = nowrap or (normal and w != 2)
+      var n = int(seg.n)
+      while i < e:
+        fstate.checkWrap(word, w)
+        if bulk and (nowrap or word.wrapPos == -1):
+          fstate.addChars(word, s.toOpenArray(i, e - 1), n * w)
+          break
+        let pi = i
+        if s[i] in Ascii:
+          inc i
+        else:
+          discard s.nextUTF8(i)
+        fstate.addChars(word, s.toOpenArray(pi, i - 1), w)
+        dec n
+    of tstSpace:
+      for c in s.toOpenArray(i, e - 1):
+        fstate.processWhitespace(word, c)
+    of tstDash:
+      fstate.checkWrap(word, w)
+      fstate.addChars(word, s.toOpenArray(i, e - 1), w)
+      fstate.addWrapPos(word)
+      word.hasSoftHyphen = false # override soft hyphen
+    of tstSoftHyphen:
       fstate.addWrapPos(word)
       word.hasSoftHyphen = true
-      continue
-    else:
-      # filter out surrogates & chars placed in our PUA range
-      var filter = false
-      if u in 0xD800'u32 .. 0xDFFF'u32 or u in TabPUARange:
-        u = 0xFFFD
-        filter = true
-      let w = u.width()
-      fstate.checkWrap(word, u, w)
-      if filter:
-        word.s.addUTF8(u)
-      else:
-        word.s &= s.toOpenArray(pi, i - 1)
-      let cw = w.toLUnit() * fstate.cellSize.w
-      word.width += cw
-      word.intrWidth += cw
-      fstate.lbstate.charwidth += w
+    of tstReplacement:
+      fstate.checkWrap(word, w)
+      fstate.addChars(word, "\uFFFD", w)
+    of tstSkip:
+      discard
+    i = e
   discard fstate.addWord(word)
   let shiftw = fstate.lbstate.computeShift(ibox).toLUnit() * fstate.cellSize.w
   #TODO not sure if this works with nowrap...
   fstate.lbstate.widthAfterWhitespace = fstate.lbstate.size.w + shiftw
 
-proc layoutText(fstate: var FlowState; ibox: InlineTextBox; s: string) =
+# Segments only depend on the text and text-transform, so we keep them in
+# the box and only redo line breaking on relayout.
+proc updateSegments(fstate: var FlowState; ibox: InlineTextBox) =
+  let text = ibox.text
   let transform = ibox.computed{"text-transform"}
-  if transform == TextTransformNone:
-    fstate.layoutTextLoop(ibox, s)
+  if ibox.segments.text == text and ibox.segments.len == text.s.len and
+      ibox.segments.transform == transform:
+    return
+  ibox.segments.s = case transform
+  of TextTransformNone: ""
+  of TextTransformCapitalize: text.s.capitalizeLU()
+  of TextTransformUppercase: text.s.toUpperLU()
+  of TextTransformLowercase: text.s.toLowerLU()
+  of TextTransformFullWidth: text.s.fullwidth()
+  of TextTransformFullSizeKana: text.s.fullsize()
+  of TextTransformChaHalfWidth: text.s.halfwidth()
+  let luctx = fstate.lctx.luctx
+  ibox.segments.segs = if transform == TextTransformNone:
+    luctx.segmentText(text.s)
+  else:
+    luctx.segmentText(ibox.segments.s)
+  ibox.segments.text = text
+  ibox.segments.len = text.s.len
+  ibox.segments.transform = transform
+
+proc layoutText(fstate: var FlowState; ibox: InlineTextBox) =
+  fstate.updateSegments(ibox)
+  if ibox.segments.transform == TextTransformNone:
+    fstate.layoutTextLoop(ibox, ibox.text.s, ibox.segments.segs)
   else:
-    let s = case transform
-    of TextTransformCapitalize: s.capitalizeLU()
-    of TextTransformUppercase: s.toUpperLU()
-    of TextTransformLowercase: s.toLowerLU()
-    of TextTransformFullWidth: s.fullwidth()
-    of TextTransformFullSizeKana: s.fullsize()
-    of TextTransformChaHalfWidth: s.halfwidth()
-    else: ""
-    fstate.layoutTextLoop(ibox, s)
+    fstate.layoutTextLoop(ibox, ibox.segments.s, ibox.segments.segs)
 
 # size is the parent's size.
 proc popPositioned(lctx: LayoutContext; head: CSSAbsolute; size: Size) =
@@ -1956,11 +2042,7 @@ proc layoutInlineBlock(fstate: var FlowState; ibox: InlineBox; box: BlockBox) =
     fstate.initLine(flag = ilfAbsolute)
     lctx.layout(box, input.margin.topLeft, input)
     if ibox.computed{"display"} == DisplayInlineListItem:
-      let atom = InlineAtom(
-        ibox: ibox,
-        box: box,
-        size: box.outerSize(input, lctx)
-      )
+      let atom = lctx.newAtom(ibox, box.outerSize(input, lctx), box = box)
       discard fstate.prepareSpace(ibox, atom.size.w)
       fstate.putAtom(atom)
     else:
@@ -1970,11 +2052,7 @@ proc layoutInlineBlock(fstate: var FlowState; ibox: InlineBox; box: BlockBox) =
     var input = lctx.resolveFloatSizes(fstate.space, box)
     lctx.layout(box, input.margin.topLeft, input)
     # Apply the block box's properties to the atom itself.
-    let atom = InlineAtom(
-      ibox: ibox,
-      box: box,
-      size: box.outerSize(input, lctx)
-    )
+    let atom = lctx.newAtom(ibox, box.outerSize(input, lctx), box = box)
     discard fstate.prepareSpace(ibox, atom.size.w)
     fstate.putAtom(atom)
     fstate.intr.w = max(fstate.intr.w, box.state.intr.w)
@@ -1998,7 +2076,7 @@ proc layoutInline(fstate: var FlowState; ibox: InlineBox) =
   if ibox of InlineTextBox:
     let ibox = InlineTextBox(ibox)
     ibox.runs.setLen(0)
-    fstate.layoutText(ibox, ibox.text.s)
+    fstate.layoutText(ibox)
   elif ibox of InlineNewLineBox:
     let ibox = InlineNewLineBox(ibox)
     fstate.finishLine(ibox, wrap = false, force = true, ibox.computed{"clear"})
@@ -2168,6 +2246,7 @@ proc layoutFlow(lctx: LayoutContext; box: BlockBox; input: LayoutInput;
 proc layoutFlowDescendant(lctx: LayoutContext; box: BlockBox; offset: Offset;
     input: LayoutInput) =
   if box.keepLayout and box.input == input:
+    inc reshapeStats.boxesKept
     box.state.offset = offset
     box.state.offset.y += box.state.yshift
     return
@@ -2181,6 +2260,7 @@ proc layoutFlowRootPre(lctx: LayoutContext; box: BlockBox; offset: Offset;
     input: LayoutInput): bool =
   let offset = offset + input.borderTopLeft(lctx)
   if box.keepLayout and box.input == input:
+    inc reshapeStats.boxesKept
     box.state.offset = offset
     return false
   box.input = input
@@ -2263,6 +2343,15 @@ proc layoutImage(lctx: LayoutContext; box: BlockBox; offset: Offset;
 # 6. in the second pass, first fix the width of columns with an author weight,
 #    *then* columns with an author width.
 #
+# Only the first sampleRows rows take part in step 1; the rest are laid
+# out once, in step 4.  This is the first row with `table-layout: fixed'
+# (if the table has a width), and the first SampledTableRows rows of
+# tables with more than LargeTableRows rows.  (So we approximate fixed
+# layout with the auto algorithm over a single row.)  Cells of later rows
+# that are wider than their columns overflow them, except for cells in
+# columns no sampled row has reached; those are measured like sampled
+# cells.
+#
 #TODO:
 # * <col>, <colgroup>
 # * distribute table height too
@@ -2275,6 +2364,7 @@ type
     real: CellWrapper # for filler wrappers
     last: bool # is this the last filler?
     reflow: bool
+    overflow: bool # not sampled; may not widen its columns
     height: LUnit
     baseline: LUnit
     inlineBorder: Span
@@ -2308,6 +2398,10 @@ type
     inlineSpacing: LUnit
     borderWidth: LUnit
     space: Space # space we got from parent
+    sampleRows: int # number of rows that determine column widths
+
+const LargeTableRows = 1000
+const SampledTableRows = 100
 
 proc layoutTableCell(lctx: LayoutContext; box: BlockBox; space: Space;
     border: CSSBorder; merge: CSSBorderMerge) =
@@ -2446,6 +2540,20 @@ proc preLayoutTableColspan(tctx: var TableContext; cellw: CellWrapper;
     tctx.cols[n].growing = cellw
   width
 
+# Like preLayoutTableColspan, but for cells past the sampled rows, which
+# do not affect column widths.  (The columns already exist; see
+# preLayoutTableRow.)
+proc skipTableColspan(tctx: var TableContext; cellw: CellWrapper;
+    n, nextn: int): LUnit =
+  var width = 0'lu
+  for col in tctx.cols.toOpenArray(n, nextn - 1):
+    width += col.width
+  let grown = cellw.rowspan - 1
+  if grown > 0:
+    tctx.cols[n].grown = grown
+    tctx.cols[n].growing = cellw
+  width
+
 proc cellWidthPx(l: CSSLength): SizeConstraint =
   if l.auto or l.perc != 0:
     return measure()
@@ -2486,22 +2594,34 @@ proc preLayoutTableRow(tctx: var TableContext; row, parent: BlockBox;
       row.next == nil, inlineBorder, blockBorder)
     borderWidth += inlineBorder.sum()
     let merge = [dtHorizontal: not firstCell, dtVertical: not firstRow]
-    lctx.layoutTableCell(box, space, border, merge)
+    let nextn = n + colspan
+    # Columns are only created by sampled cells, so measure cells that
+    # reach past them too; otherwise the new columns would be 0 wide.
+    let sampled = rowi < tctx.sampleRows or nextn > tctx.cols.len
+    if sampled:
+      lctx.layoutTableCell(box, space, border, merge)
+    else:
+      # saved for layoutTableRow, which lays out the cell
+      box.input.border = border
+      box.state.merge = merge
     let cellw = CellWrapper(
       box: box,
       colspan: colspan,
       rowspan: rowspan,
       coli: n,
       inlineBorder: inlineBorder,
-      reflow: space.w.t == scMeasure
+      reflow: not sampled or space.w.t == scMeasure,
+      overflow: not sampled
     )
     if cellTail != nil:
       cellTail.next = cellw
     else:
       cellHead = cellw
     cellTail = cellw
-    let nextn = n + colspan
-    width += tctx.preLayoutTableColspan(cellw, space, rowi, n, nextn, perc)
+    if sampled:
+      width += tctx.preLayoutTableColspan(cellw, space, rowi, n, nextn, perc)
+    else:
+      width += tctx.skipTableColspan(cellw, n, nextn)
     # add spacing for border inside colspan
     let spacing = tctx.inlineSpacing * ((colspan - 1) * 2).toLUnit()
     width += spacing
@@ -2558,7 +2678,11 @@ proc layoutTableRow(tctx: TableContext; ctx: RowContext;
       let border = cellw.box.input.border
       let merge = cellw.box.state.merge
       tctx.lctx.layoutTableCell(cellw.box, space, border, merge)
-      w = max(w, cellw.box.state.size.w)
+      if cellw.overflow:
+        # keep the columns aligned, and let the contents overflow
+        cellw.box.state.size.w = w
+      else:
+        w = max(w, cellw.box.state.size.w)
       row.state.intr.w += cellw.box.state.intr.w
     let cell = cellw.box
     x += cellw.inlineBorder.start
@@ -2623,6 +2747,8 @@ proc preLayoutTableRows(tctx: var TableContext; table: BlockBox) =
       assert it.computed{"display"} == DisplayTableRow
       inc nrows
   tctx.rows = newSeqOfCap[RowContext](nrows)
+  if nrows > LargeTableRows:
+    tctx.sampleRows = min(tctx.sampleRows, SampledTableRows)
   if thead != nil:
     for child in thead.children:
       tctx.preLayoutTableRow(BlockBox(child), table, nrows)
@@ -2819,6 +2945,9 @@ proc layoutInnerTable(tctx: var TableContext; table, parent: BlockBox;
   if table.computed{"border-collapse"} != BorderCollapseCollapse:
     tctx.inlineSpacing = table.computed{"-cha-border-spacing-inline"}.px(0'lu)
     tctx.blockSpacing = table.computed{"-cha-border-spacing-block"}.px(0'lu)
+  if table.computed{"table-layout"} == TableLayoutFixed and
+      not parent.computed{"width"}.auto:
+    tctx.sampleRows = 1
   tctx.preLayoutTableRows(table) # first pass
   let weightRatio = if tctx.hasAuthorWeight and tctx.space.w.isDefinite():
     tctx.expandToWeight()
@@ -2855,7 +2984,7 @@ proc layoutTable(lctx: LayoutContext; box: BlockBox; offset: Offset;
   let table = BlockBox(box.firstChild)
   table.keepLayout = true
   table.resetState()
-  var tctx = TableContext(lctx: lctx, space: input.space)
+  var tctx = TableContext(lctx: lctx, space: input.space, sampleRows: int.high)
   let caption = BlockBox(table.next)
   var captionSpace = initSpace(
     w = fitContent(input.space.w),
@@ -3174,6 +3303,7 @@ proc layoutFlex(lctx: LayoutContext; box: BlockBox; offset: Offset;
 
 proc layout(lctx: LayoutContext; box: BlockBox; offset: Offset;
     input: LayoutInput; root = irfNone) =
+  inc reshapeStats.boxes
   case box.computed{"display"}
   of DisplayFlowRoot, DisplayTableCaption, DisplayInlineBlock,
       DisplayInlineBlockListItem, DisplayInnerGrid, DisplayMarker,
@@ -1,5 +1,7 @@
 {.push raises: [].}
 
+import std/tables
+
 import chame/tags
 import css/cssparser
 import css/cssvalues
@@ -32,6 +34,9 @@ type
   LayerList = object
     s: seq[CAtom]
 
+  OwnedAtoms = object
+    s: seq[CAtom]
+
   StyleState = object
     importList*: seq[CSSImport]
     layers: LayerList
@@ -75,6 +80,37 @@ type
     anonLayers: uint16
     quirks*: bool
     layers: LayerList
+    # Rules of the user agent and user sheets, hashed once and shared by
+    # all documents; looked up in addition to the tables above.
+    ua*: CSSRuleMap
+    sheets: seq[CSSStylesheet]
+    invalidation: InvalidationMap
+
+  InvalidationFlag* = enum
+    ifSelf # the element itself
+    ifSubtree # the element and all its descendants
+    ifSiblings # the element's following siblings and their descendants
+    ifParent # the element's parent and all its descendants
+
+  # Elements that may have to be restyled after a class, id or attribute of
+  # an element changes.
+  InvalidationSet* = object
+    flags*: set[InvalidationFlag]
+    # Descendants with one of these tags, classes or ids; ignored if
+    # ifSubtree is set.
+    tags*: seq[CAtom]
+    classes*: seq[CAtom]
+    ids*: seq[CAtom]
+
+  InvalidationFeature* = enum
+    ifkClass, ifkId, ifkAttr
+
+  # Invalidation sets of every class, id and attribute that appears in a
+  # selector of the map.  Built on the first mutation that needs it.
+  InvalidationMap = object
+    built: bool
+    sets: array[InvalidationFeature, Table[CAtom, InvalidationSet]]
+    lowered: OwnedAtoms # lower-cased keys of quirks mode maps
 
   SelectorHashes = object
     tags: seq[CAtom]
@@ -89,7 +125,15 @@ proc addRule(sheet: CSSStylesheet; rule: CSSQualifiedRule; layer: CAtomTraced)
 proc addAtRule(sheet: CSSStylesheet; atrule: CSSAtRule; base: URL;
   layer: CAtomTraced): Opt[void]
 
-proc newCSSRuleMap*(quirks: bool): CSSRuleMap =
+proc newCSSRuleMap*(quirks: bool; ua: CSSRuleMap = nil): CSSRuleMap =
+  if ua != nil:
+    # continue numbering after the shared sheets
+    return CSSRuleMap(
+      quirks: quirks,
+      ua: ua,
+      sheetId: ua.sheetId,
+      anonLayers: ua.anonLayers
+    )
   CSSRuleMap(quirks: quirks)
 
 iterator getAll*(map: RuleTable; name: CAtom): CSSRuleDef =
@@ -108,6 +152,10 @@ proc `=destroy`(list: var LayerList) =
   freeAtoms(list.s)
   list.s.reset()
 
+proc `=destroy`(list: var OwnedAtoms) =
+  freeAtoms(list.s)
+  list.s.reset()
+
 proc put0(map: var RuleTable; name: CAtom; def: CSSRuleDef): bool =
   let mask = map.tab.len - 1
   var home = name.hash() and mask
@@ -249,6 +297,9 @@ proc add(sheet: CSSRuleMap; rule: CSSRuleDef) =
       sheet.typeList[hashes.t].add(rule)
 
 proc add*(map: CSSRuleMap; sheet: CSSStylesheet) =
+  map.sheets.add(sheet)
+  if map.invalidation.built: # rebuild it on the next lookup
+    map.invalidation = InvalidationMap()
   let sheetId = map.sheetId
   sheet.s.idx = sheetId
   inc map.sheetId
@@ -274,6 +325,148 @@ proc add*(map: CSSRuleMap; sheet: CSSStylesheet) =
     map.add(def)
     def = def.next
 
+# Invalidation sets are a simplified version of what Blink does.  For
+# each class, id and attribute that appears in a selector, we record
+# which elements its change may affect:
+#
+# * in the rightmost compound selector: the element itself
+# * in a compound followed by a descendant or child combinator:
+#   descendants that have a tag, class or id of the rightmost compound
+#   (or all descendants, if it has none)
+# * in a compound followed by a sibling combinator: following siblings
+#   and their descendants
+#
+# Selectors that we can't (or don't bother to) analyze fall back to
+# ConservativeSet or, for nth-child(... of S), the parent's subtree.
+
+const ConservativeSet = InvalidationSet(
+  flags: {ifSelf, ifSubtree, ifSiblings}
+)
+
+# Above this many descendant features, restyling the whole subtree is
+# cheaper than matching each descendant against them.
+const MaxDescendantFeatures = 32
+
+proc merge(a: var InvalidationSet; b: InvalidationSet) =
+  a.flags.incl(b.flags)
+  if ifSubtree notin a.flags:
+    for it in b.tags:
+      if it notin a.tags:
+        a.tags.add(it)
+    for it in b.classes:
+      if it notin a.classes:
+        a.classes.add(it)
+    for it in b.ids:
+      if it notin a.ids:
+        a.ids.add(it)
+    if a.tags.len + a.classes.len + a.ids.len > MaxDescendantFeatures:
+      a.flags.incl(ifSubtree)
+  if ifSubtree in a.flags:
+    a.tags.setLen(0)
+    a.classes.setLen(0)
+    a.ids.setLen(0)
+
+proc addFeature(map: CSSRuleMap; kind: InvalidationFeature; atom: CAtom;
+    iset: InvalidationSet) =
+  var atom = atom
+  if map.quirks and kind != ifkAttr:
+    # classes and ids match case-insensitively in quirks mode
+    atom = atom.toLowerAscii()
+    map.invalidation.lowered.s.add(atom)
+  map.invalidation.sets[kind].mgetOrPut(atom, InvalidationSet()).merge(iset)
+
+proc addFeatures(map: CSSRuleMap; sel: Selector; iset: InvalidationSet)
+
+# Selectors in the argument of a pseudo-class function.
+proc addFeatures(map: CSSRuleMap; slist: SelectorList;
+    iset: InvalidationSet) =
+  for cxsel in slist:
+    # Compound selectors are matched against the same element as the
+    # pseudo-class; anything more complex gets the fallback.
+    let iset = if cxsel.len == 1 or ifParent in iset.flags:
+      iset
+    else:
+      ConservativeSet
+    for csel in cxsel:
+      for sel in csel:
+        map.addFeatures(sel, iset)
+
+proc addFeatures(map: CSSRuleMap; sel: Selector; iset: InvalidationSet) =
+  case sel.t
+  of stClass: map.addFeature(ifkClass, sel.atom.view(), iset)
+  of stId: map.addFeature(ifkId, sel.atom.view(), iset)
+  of stAttr: map.addFeature(ifkAttr, sel.atom.view(), iset)
+  of stIs, stWhere, stNot: map.addFeatures(sel.fsels, iset)
+  of stNthChild, stNthLastChild:
+    # changes the index of siblings on both sides
+    map.addFeatures(sel.nthChild.ofsels, InvalidationSet(flags: {ifParent}))
+  of stHost:
+    if sel.host != nil:
+      for it in sel.host.csel:
+        map.addFeatures(it, ConservativeSet)
+  of stLang: # inherited from ancestors
+    map.addFeature(ifkAttr, satLang.toAtom(), ConservativeSet)
+  of stPseudoClass:
+    case sel.pc
+    of pcLink, pcVisited: map.addFeature(ifkAttr, satHref.toAtom(), iset)
+    of pcBorderNonzero: map.addFeature(ifkAttr, satBorder.toAtom(), iset)
+    of pcDisabled: # fieldsets disable their descendants
+      map.addFeature(ifkAttr, satDisabled.toAtom(), ConservativeSet)
+    else: discard
+  of stType, stUniversal: discard
+
+proc addFeatures(map: CSSRuleMap; cxsel: ComplexSelector) =
+  # Descendants can only match if they have a tag, class or id of the
+  # rightmost compound; any one of them will do.
+  var subject = InvalidationSet(flags: {ifSubtree})
+  for sel in cxsel[^1]:
+    case sel.t
+    of stId:
+      subject = InvalidationSet(ids: @[sel.atom.view()])
+      break
+    of stClass:
+      if subject.classes.len == 0:
+        subject = InvalidationSet(classes: @[sel.atom.view()])
+    of stType:
+      if ifSubtree in subject.flags:
+        subject = InvalidationSet(tags: @[sel.atom.view()])
+    else: discard
+  let last = cxsel.len - 1
+  for i in 0 .. last:
+    let iset = if i == last:
+      InvalidationSet(flags: {ifSelf})
+    elif cxsel[i].ct in {ctDescendant, ctChild}:
+      subject
+    else:
+      InvalidationSet(flags: {ifSiblings})
+    for sel in cxsel[i]:
+      map.addFeatures(sel, iset)
+
+proc buildInvalidation(map: CSSRuleMap) =
+  map.invalidation.built = true
+  for sheet in map.sheets:
+    var def = sheet.s.defsHead
+    while def != nil:
+      for cxsel in def.sels:
+        map.addFeatures(cxsel)
+      def = def.next
+
+# Add the invalidation set of the class, id or attribute `atom' to `res'.
+proc getInvalidationSet*(map: CSSRuleMap; kind: InvalidationFeature;
+    atom: CAtom; res: var InvalidationSet) =
+  if map.ua != nil:
+    map.ua.getInvalidationSet(kind, atom, res)
+  if not map.invalidation.built:
+    map.buildInvalidation()
+  if map.quirks and kind != ifkAttr:
+    let lower = atom.toLowerAscii()
+    map.invalidation.sets[kind].withValue(lower, p):
+      res.merge(p[])
+    freeAtom(lower)
+  else:
+    map.invalidation.sets[kind].withValue(atom, p):
+      res.merge(p[])
+
 proc add(s: var StyleState; ruleDef: CSSRuleDef) =
   if s.defsTail == nil:
     s.defsHead = ruleDef
@@ -429,9 +622,9 @@ proc addAtRule(sheet: CSSStylesheet; atrule: CSSAtRule; base: URL;
       sheet.s.layers.s.add(names)
   ok()
 
-proc parseStylesheet*(iq: string; base: URL; settings: ptr EnvironmentSettings;
-    origin: CSSOrigin; layer: CAtomTraced): CSSStylesheet =
-  var ctx = initCSSParser(iq)
+proc parseStylesheet(ctx: var CSSParser; base: URL;
+    settings: ptr EnvironmentSettings; origin: CSSOrigin; layer: CAtomTraced):
+    CSSStylesheet =
   let sheet = CSSStylesheet(
     settings: settings,
     origin: origin,
@@ -442,6 +635,22 @@ proc parseStylesheet*(iq: string; base: URL; settings: ptr EnvironmentSettings;
   sheet.toks = move(ctx.toks)
   return sheet
 
+proc parseStylesheet*(iq: string; base: URL; settings: ptr EnvironmentSettings;
+    origin: CSSOrigin; layer: CAtomTraced): CSSStylesheet =
+  var ctx = initCSSParser(iq)
+  return ctx.parseStylesheet(base, settings, origin, layer)
+
+# Parse a sheet from the tokens of a previously parsed one.  Destroys
+# `toks'.
+proc parseStylesheet*(toks: var seq[CSSToken]; base: URL;
+    settings: ptr EnvironmentSettings; origin: CSSOrigin; layer: CAtomTraced):
+    CSSStylesheet =
+  var ctx = initCSSParserSink(toks)
+  return ctx.parseStylesheet(base, settings, origin, layer)
+
+proc tokens*(sheet: CSSStylesheet): lent seq[CSSToken] =
+  return sheet.toks
+
 proc windowChange*(sheet: CSSStylesheet; base: URL) =
   var ctx = initCSSParserSink(sheet.toks)
   sheet.s = StyleState()
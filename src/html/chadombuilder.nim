@@ -196,7 +196,8 @@ proc moveChildrenImpl(builder: ChaDOMBuilder; fromNode, toNode: ParentNode) =
   for child in toMove:
     toNode.insert(child, nil, nil)
 
-proc sortAttrsImpl(builder: ChaDOMBuilder; attrs: var seq[ParsedAttr[CAtom]]) =
+# Sort attrs by name and drop duplicates, keeping the first one.
+proc sortAttrs(attrs: var seq[ParsedAttr[CAtom]]) =
   if attrs.len > 1:
     attrs.sort(proc(a, b: ParsedAttr[CAtom]): int {.nimcall.} =
       cmp(uint32(a.name), uint32(b.name))
@@ -212,6 +213,9 @@ proc sortAttrsImpl(builder: ChaDOMBuilder; attrs: var seq[ParsedAttr[CAtom]]) =
       prev = name
     attrs.setLen(j)
 
+proc sortAttrsImpl(builder: ChaDOMBuilder; attrs: var seq[ParsedAttr[CAtom]]) =
+  attrs.sortAttrs()
+
 proc addAttrsIfMissingImpl(builder: ChaDOMBuilder; handle: ParentNode;
     attrs: seq[ParsedAttr[CAtom]]) =
   let element = Element(handle)
@@ -266,8 +270,222 @@ proc newChaDOMBuilder(url: URL; window: Window; confidence: CharsetConfidence;
     charset: charset
   )
 
+# Fast path for fragment parsing.
+#
+# Template-heavy scripts set innerHTML to plain markup over and over, and
+# setting up a parser for each is expensive.  For markup the tree builder
+# would process without error recovery, we build the nodes directly: only
+# the tags below, only well-nested end tags, no comments, and only a few
+# character references.  If the markup leaves this subset, we give up and
+# the full parser starts over.
+const FastBlockTags = {
+  ttAddress, ttArticle, ttAside, ttBlockquote, ttCenter, ttDiv, ttFigcaption,
+  ttFigure, ttFooter, ttHeader, ttHgroup, ttLi, ttMain, ttNav, ttOl, ttP,
+  ttSearch, ttSection, ttUl
+} + HTagTypes # start tags that close an open p
+
+const FastInlineTags = {
+  ttA, ttAbbr, ttB, ttBdi, ttBdo, ttBig, ttCite, ttCode, ttData, ttDel, ttDfn,
+  ttEm, ttFont, ttI, ttIns, ttKbd, ttMark, ttQ, ttS, ttSamp, ttSmall, ttSpan,
+  ttStrike, ttStrong, ttSub, ttSup, ttTime, ttTt, ttU, ttVar
+}
+
+const FastVoidTags = {ttBr, ttImg, ttWbr}
+
+const FastTags = FastBlockTags + FastInlineTags + FastVoidTags
+
+# Context elements that put the tree builder "in body", with the tokenizer
+# in the data state.
+const FastContextTags = FastBlockTags + FastInlineTags + {ttBody, ttDd, ttDt}
+
+const FastEntities = [
+  ("amp;", "&"), ("lt;", "<"), ("gt;", ">"), ("quot;", "\""), ("apos;", "'"),
+  ("nbsp;", "\u00A0")
+]
+
+const FastWhitespace = {' ', '\t', '\n', '\f'}
+
+type FastFragmentParser = object
+  document: Document
+  stack: seq[Element]
+  nodes: seq[Node]
+  text: string
+
+proc append(parser: var FastFragmentParser; node: Node) =
+  if parser.stack.len > 0:
+    parser.stack[^1].insert(node, nil, nil)
+  else:
+    parser.nodes.add(node)
+
+proc flushText(parser: var FastFragmentParser) =
+  if parser.text.len > 0:
+    parser.append(parser.document.newText(move(parser.text)))
+    parser.text = ""
+
+# Decode the character reference starting at s[i].
+proc parseEntity(res: var string; s: openArray[char]; i: var int): bool =
+  let j = i + 1
+  if j >= s.len or s[j] notin AsciiAlphaNumeric + {'#'}:
+    res &= '&' # not a character reference
+    i = j
+    return true
+  for (name, value) in FastEntities:
+    if j + name.len <= s.len and
+        s.toOpenArray(j, j + name.len - 1) == name.toOpenArray(0, name.high):
+      res &= value
+      i = j + name.len
+      return true
+  false
+
+proc parseAttrValue(s: openArray[char]; i: var int; value: var string):
+    bool =
+  if i >= s.len:
+    return false
+  let q = s[i]
+  if q in {'"', '\''}:
+    inc i
+    while true:
+      if i >= s.len:
+        return false
+      let c = s[i]
+      if c == q:
+        inc i
+        break
+      if c == '&':
+        if not value.parseEntity(s, i):
+          return false
+      elif c in {'\0', '\r'}:
+        return false
+      else:
+        value &= c
+        inc i
+    return i >= s.len or s[i] in FastWhitespace + {'>', '/'}
+  while i < s.len and s[i] notin FastWhitespace + {'>'}:
+    let c = s[i]
+    if c == '&':
+      if not value.parseEntity(s, i):
+        return false
+    elif c in {'"', '\'', '<', '=', '`', '\0', '\r'}:
+      return false
+    else:
+      value &= c
+      inc i
+  value.len > 0
+
+proc parseTag(parser: var FastFragmentParser; s: openArray[char];
+    i: var int): bool =
+  var j = i + 1
+  let endTag = j < s.len and s[j] == '/'
+  if endTag:
+    inc j
+  if j >= s.len or s[j] notin AsciiAlpha:
+    return false
+  var name = ""
+  while j < s.len and s[j] in AsciiAlphaNumeric:
+    name &= s[j].toLowerAscii()
+    inc j
+  # e.g. <nav-bar> or <span_x>: the name goes on, and is not a fast tag
+  if j < s.len and s[j] notin FastWhitespace + {'/', '>'}:
+    return false
+  let tagType = name.toAtomView().toTagType()
+  if tagType notin FastTags:
+    return false
+  parser.flushText()
+  if endTag:
+    if j >= s.len or s[j] != '>' or parser.stack.len == 0 or
+        parser.stack[^1].tagType != tagType:
+      return false
+    discard parser.stack.pop()
+    i = j + 1
+    return true
+  var attrs: seq[tuple[name, value: string]] = @[]
+  while true:
+    while j < s.len and s[j] in FastWhitespace:
+      inc j
+    if j >= s.len:
+      return false
+    if s[j] == '>':
+      inc j
+      break
+    if s[j] == '/':
+      # the self-closing flag is ignored on non-void elements
+      if j + 1 >= s.len or s[j + 1] != '>':
+        return false
+      j += 2
+      break
+    var attr = (name: "", value: "")
+    while j < s.len and s[j] in AsciiAlphaNumeric + {'-', '_'}:
+      attr.name &= s[j].toLowerAscii()
+      inc j
+    if attr.name.len == 0 or j >= s.len or
+        s[j] notin FastWhitespace + {'=', '>', '/'}:
+      return false
+    var k = j
+    while k < s.len and s[k] in FastWhitespace:
+      inc k
+    if k < s.len and s[k] == '=':
+      j = k + 1
+      while j < s.len and s[j] in FastWhitespace:
+        inc j
+      if not s.parseAttrValue(j, attr.value):
+        return false
+    attrs.add(attr)
+  # The tree builder would close (or reopen) something for these.
+  for it in parser.stack:
+    let tt = it.tagType
+    if tagType in FastBlockTags and tt == ttP or
+        tagType == ttLi and tt == ttLi or tagType == ttA and tt == ttA:
+      return false
+  if tagType in HTagTypes and parser.stack.len > 0 and
+      parser.stack[^1].tagType in HTagTypes:
+    return false
+  let element = parser.document.newHTMLElement(tagType)
+  if attrs.len > 0:
+    var parsed = newSeqOfCap[ParsedAttr[CAtom]](attrs.len)
+    for attr in attrs.mitems:
+      parsed.add(ParsedAttr[CAtom](
+        name: attr.name.toAtom(),
+        namespace: nsNone.toStaticAtom().toAtom(),
+        value: move(attr.value)
+      ))
+    parsed.sortAttrs()
+    element.sinkAttrs(move(parsed))
+  parser.append(element)
+  if tagType notin FastVoidTags:
+    parser.stack.add(element)
+  i = j
+  true
+
+proc parseHTMLFragmentFast*(element: Element; s: openArray[char];
+    res: var seq[Node]): bool =
+  if element.tagType notin FastContextTags:
+    return false
+  let document = newDocument(parseURL0("about:blank"))
+  document.contentType = satTextHtml
+  document.mode = element.document.mode
+  var parser = FastFragmentParser(document: document)
+  var i = 0
+  while i < s.len:
+    case s[i]
+    of '<':
+      if not parser.parseTag(s, i):
+        return false
+    of '&':
+      if not parser.text.parseEntity(s, i):
+        return false
+    of '\0', '\r':
+      return false
+    else:
+      let start = i
+      while i < s.len and s[i] notin {'<', '&', '\0', '\r'}:
+        inc i
+      parser.text.add(s.toOpenArray(start, i - 1))
+  parser.flushText()
+  res = move(parser.nodes)
+  true
+
 # https://html.spec.whatwg.org/multipage/parsing.html#parsing-html-fragments
-proc parseHTMLFragment*(element: Element; s: openArray[char]): seq[Node] =
+proc parseHTMLFragmentFull*(element: Element; s: openArray[char]): seq[Node] =
   let url = parseURL0("about:blank")
   let builder = newChaDOMBuilder(url, nil, ccIrrelevant)
   let document = builder.document
@@ -299,6 +517,11 @@ proc parseHTMLFragment*(element: Element; s: openArray[char]): seq[Node] =
   builder.finish()
   return root.getChildList()
 
+proc parseHTMLFragment*(element: Element; s: openArray[char]): seq[Node] =
+  result = @[]
+  if not element.parseHTMLFragmentFast(s, result):
+    result = element.parseHTMLFragmentFull(s)
+
 proc newHTML5ParserWrapper*(window: Window; url: URL;
     confidence: CharsetConfidence; charset: Charset): HTML5ParserWrapper =
   let opts = HTML5ParserOpts[ParentNode, CAtom](
@@ -198,6 +198,10 @@ type
 
   Storage* = ref object
     map*: seq[tuple[key, value: string]]
+    index*: Table[string, int] # key -> position in map
+    size*: int # total length of keys and values
+    loader*: FileLoader # if not nil, changes are persisted by the loader
+    loaded*: bool # persistent contents have been read
 
   Crypto* = ref object
     urandom*: PosixStream
@@ -297,9 +301,18 @@ type
 
   CollectionLike = ref CollectionLikeObj
 
+  # The mutations a live collection depends on; see affectedBy.
+  CollectionKey = enum
+    ckAny # every mutation
+    ckElements # insertion or removal of elements
+    ckTag # insertion or removal of elements with tagType
+    ckClass # insertion, removal or class change of elements with atoms
+
   Collection = ref object of CollectionLikeObj
     childonly: bool
     invalid: bool
+    key: CollectionKey
+    tagType: TagType
     match: CollectionMatchFun
     snapshot: seq[Node]
     atoms: seq[CAtom]
@@ -334,6 +347,9 @@ type
 
   DOMTokenList = ref object
     toks: seq[CAtom]
+    # Classes counted in the document's classCounts.  (add() etc. modify
+    # toks before the attribute changes, so toks cannot be used for this.)
+    indexed: seq[CAtom]
     element: Element
     localName: StaticAtom
 
@@ -375,6 +391,25 @@ type
     i*: int
     prev*: DocumentWriteBuffer
 
+  # Memoized result of querySelector (all = false) or querySelectorAll.
+  QueryCacheEntry = object
+    root: ParentNode
+    query: string
+    all: bool
+    nodes: seq[Node]
+
+  # User agent, quirks mode and user style sheets, parsed and hashed once
+  # per environment and shared by every document in it.  (The fork server
+  # prepares them before forking a buffer, so buffers inherit them.)
+  UASheets = ref object
+    attrs: WindowAttributes
+    settings: EnvironmentSettings
+    user: string
+    ua: CSSStylesheet
+    quirks: CSSStylesheet
+    userSheet: CSSStylesheet
+    maps: array[bool, CSSRuleMap] # by quirks mode
+
   Document* = ref DocumentObj
 
   DocumentObj = object of ParentNode
@@ -405,8 +440,7 @@ type
     internalFocus: Element
     internalTarget: Element
     renderBlockingElements: seq[Element]
-    uaSheetsHead: CSSStylesheet
-    userSheet: CSSStylesheet
+    uaSheets: UASheets
     authorSheetsHead: CSSStylesheet
     sheetTitle: string
     ruleMap: CSSRuleMap
@@ -416,10 +450,26 @@ type
     parser*: RootRef
     liveCollectionsHead: ptr CollectionLikeObj
     cachedAll: HTMLAllCollection
+    selectorCache: Table[string, SelectorList]
+    queryCache: seq[QueryCacheEntry] # dropped by invalidateCollections
+    # Number of connected elements (outside shadow trees) per tag and class;
+    # see updateIndex.  classCounts owns its keys.
+    tagCounts: array[TagType, int32]
+    classCounts: Table[CAtom, int32]
+    mixedCaseTags: int32 # HTML elements whose local name is not lower case
     customElements: CustomElementRegistry #TODO ?
 
   XMLDocument {.final.} = ref object of Document
 
+  # Keys touched by a mutation.  Live collections whose key is not among
+  # them remain valid.
+  IndexChange = object
+    all: bool
+    elements: bool
+    allTags: bool
+    tags: set[TagType]
+    classes: seq[CAtom]
+
   CharacterData* = ref object of Node
     # Note: layout assumes this is only modified directly by appending text.
     data* {.jsgetset.}: RefString
@@ -477,7 +527,8 @@ type
     cesCustom = "custom"
 
   ElementFlag = enum
-    efHint, efHover, efShadowRoot, efChildElIndicesInvalid, efRestyle
+    efHint, efHover, efShadowRoot, efChildElIndicesInvalid, efRestyle,
+    efRestyleSubtree
 
   Element* = ref object of ParentNode
     namespaceURI* {.jsget.}: CAtom # 4
@@ -726,6 +777,7 @@ jsDestructor(CustomElementRegistry)
 # Forward declarations
 proc loadSheet(window: Window; this: SheetElement; url: URL; charset: Charset;
   layer: CAtomTraced; finish: LoadSheetFinish; i: int; parseEnv: ParseSheetEnv)
+proc getUASheets(settings: EnvironmentSettings; user: string): UASheets
 
 proc newCDATASection(document: Document; data: RefString): CDATASection
 proc newComment(document: Document; data: RefString): Comment
@@ -784,6 +836,8 @@ proc baseURL*(document: Document): URL
 proc documentElement*(document: Document): Element
 proc getElementById*(document: Document; id: CAtomTraced): Element
 proc invalidateCollections(document: Document)
+proc invalidateCollections(document: Document; change: IndexChange)
+proc invalidateCollectionsInsert(document: Document; node: Node)
 proc invalidateCollectionsRemove(document: Document; node: Node)
 proc parseURL0*(document: Document; s: string): URL
 proc parseURL*(document: Document; s: string): Opt[URL]
@@ -838,6 +892,7 @@ proc removingSteps(element: Element)
 proc scriptingEnabled(element: Element): bool
 proc shadowRoot(this: Element): ShadowRoot
 proc tagType*(element: Element; namespace = satNamespaceHTML): TagType
+proc tagTypeNoNS(element: Element): TagType
 
 proc globalCustomElements(this: ShadowRoot): CustomElementRegistry
 
@@ -1381,11 +1436,13 @@ proc newWeakCollection(ctx: JSContext; this: Node; wwm: WindowWeakMap):
     JSValue =
   case wwm
   of wwmChildren:
-    return ctx.toJS(newHTMLCollection(
+    let collection = newHTMLCollection(
       this,
       match = isElement,
       childonly = true
-    ))
+    )
+    collection.key = ckElements
+    return ctx.toJS(collection)
   of wwmChildNodes:
     return ctx.toJS(newNodeList(
       this,
@@ -1488,10 +1545,43 @@ proc importSheetFinish(window: Window; this: SheetElement;
       env.parent, env.i)
   window.sheetLoaded()
 
+# Tokenizing small sheets is cheaper than asking the loader for them.
+const StyleCacheMinSize = 4096
+
+# Parse `s', reusing its tokens from the style cache if a document of the
+# same origin has already parsed the same sheet.  Only the tokens are
+# cached, because the parsed rules depend on the window (media queries,
+# units) and the sheet's URL.
+proc parseStylesheetCached(window: Window; s: string; baseURL: URL;
+    layer: CAtomTraced): CSSStylesheet =
+  let settings = addr window.settings
+  if s.len < StyleCacheMinSize:
+    return s.parseStylesheet(baseURL, settings, coAuthor, layer)
+  let key = getParseCacheKey(s, "css")
+  let cached = window.loader.getParseCache(pckStyle, key)
+  if cached.isOk and cached.get != nil:
+    let ps = cached.get
+    let mem = ps.readAllOrMmap()
+    ps.sclose()
+    var toks: seq[CSSToken] = @[]
+    let p = cast[ptr UncheckedArray[char]](mem.p)
+    let valid = mem.len > 0 and
+      p.toOpenArray(0, mem.len - 1).deserializeTokens(toks)
+    deallocMem(mem)
+    if valid:
+      return toks.parseStylesheet(baseURL, settings, coAuthor, layer)
+    # corrupt entry; tokenize the sheet again and overwrite it
+  let sheet = s.parseStylesheet(baseURL, settings, coAuthor, layer)
+  if cached.isOk:
+    var data = ""
+    data.serializeTokens(sheet.tokens)
+    window.loader.putParseCache(pckStyle, key, data)
+  sheet
+
 proc parseStylesheet(window: Window; this: SheetElement; s: string;
     baseURL: URL; charset: Charset; layer: CAtomTraced;
     finish: LoadSheetFinish; parseEnv: ParseSheetEnv; i: int) =
-  let sheet = s.parseStylesheet(baseURL, addr window.settings, coAuthor, layer)
+  let sheet = window.parseStylesheetCached(s, baseURL, layer)
   if sheet.s.importList.len == 0:
     let res = LoadSheetResult(head: sheet, tail: sheet)
     finish(window, this, res, parseEnv, i)
@@ -1877,13 +1967,9 @@ proc windowChange*(window: Window) =
   if document.documentElement != nil:
     document.documentElement.invalidate()
   let baseURL = document.baseURL
-  var sheet = document.uaSheetsHead
-  while sheet != nil:
-    sheet.windowChange(baseURL)
-    sheet = sheet.next
-  if document.userSheet != nil:
-    document.userSheet.windowChange(baseURL)
-  sheet = document.authorSheetsHead
+  if document.uaSheets != nil:
+    document.uaSheets = window.settings.getUASheets(document.uaSheets.user)
+  var sheet = document.authorSheetsHead
   while sheet != nil:
     sheet.windowChange(baseURL)
     if sheet.media != "":
@@ -2432,7 +2518,6 @@ proc removeImpl*(node: Node; suppressObservers = false) =
   node.internalPrev = nil
   node.internalNext = document
   node.parentNode = nil
-  document.invalidateCollections()
   if element != nil:
     if parentElement != nil and next.parentNode == parent:
       parentElement.flags.incl(efChildElIndicesInvalid)
@@ -2763,11 +2848,15 @@ proc serializeFragmentInner(res: var string; child: Node; parentType: TagType;
         res &= $attr.name
       if local:
         let i = attr.name.find(':') + 1
-        res &= ($attr.name).substr(i)
-      res &= "=\"" & attr.value.htmlEscape(mode = emAttribute) & "\""
+        res.add(($attr.name).toOpenArray(i, attr.name.len - 1))
+      res &= "=\""
+      res.htmlEscape(attr.value, mode = emAttribute)
+      res &= '"'
     res &= '>'
     res.serializeFragment(element, writeShadow)
-    res &= "</" & $tag & '>'
+    res &= "</"
+    res &= $tag
+    res &= '>'
   elif child of Text:
     let text = Text(child)
     const LiteralTags = {
@@ -2777,14 +2866,22 @@ proc serializeFragmentInner(res: var string; child: Node; parentType: TagType;
     if parentType in LiteralTags:
       res &= text.data.s
     else:
-      res &= text.data.s.htmlEscape(mode = emText)
+      res.htmlEscape(text.data.s, mode = emText)
   elif child of Comment:
-    res &= "<!--" & Comment(child).data.s & "-->"
+    res &= "<!--"
+    res &= Comment(child).data.s
+    res &= "-->"
   elif child of ProcessingInstruction:
     let inst = ProcessingInstruction(child)
-    res &= "<?" & inst.target & " " & inst.data.s & '>'
+    res &= "<?"
+    res &= inst.target
+    res &= ' '
+    res &= inst.data.s
+    res &= '>'
   elif child of DocumentType:
-    res &= "<!DOCTYPE " & DocumentType(child).name & '>'
+    res &= "<!DOCTYPE "
+    res &= DocumentType(child).name
+    res &= '>'
 
 proc serializeFragment(res: var string; node: Node; writeShadow: bool) =
   var node = node
@@ -3067,7 +3164,9 @@ proc childTextContent*(node: ParentNode): string =
 proc getElementsByTagNameImpl(root: ParentNode; tagName: CAtomTraced):
     HTMLCollection =
   if tagName == satUstar:
-    return newHTMLCollection(root, isElement, childonly = false)
+    let this = newHTMLCollection(root, isElement, childonly = false)
+    this.key = ckElements
+    return this
   let this = newHTMLCollection(
     root,
     proc(this: Collection; node: Node): bool =
@@ -3081,6 +3180,11 @@ proc getElementsByTagNameImpl(root: ParentNode; tagName: CAtomTraced):
     childonly = false
   )
   this.atoms = @[tagName.dup()]
+  # Upper-case and prefixed names match elements from several tag types.
+  let tagType = tagName.toTagType()
+  if tagType != ttUnknown:
+    this.key = ckTag
+    this.tagType = tagType
   this
 
 proc getElementsByClassNameImpl(node: ParentNode; classNames: DOMString):
@@ -3104,6 +3208,7 @@ proc getElementsByClassNameImpl(node: ParentNode; classNames: DOMString):
   )
   for class in classNames.toOpenArray().split(AsciiWhitespace):
     this.atoms.add(class.toAtom())
+  this.key = if this.atoms.len > 0: ckClass else: ckElements
   this
 
 proc insert0(parent: ParentNode; node, before: Node;
@@ -3140,7 +3245,10 @@ proc insert0(parent: ParentNode; node, before: Node;
       element.internalElIndex = prev.internalElIndex + 1
     else:
       element.internalElIndex = 0
-  parentDocument.invalidateCollections()
+  if rootNode == parentDocument:
+    parentDocument.invalidateCollectionsInsert(node)
+  else:
+    parentDocument.invalidateCollections()
   if parentElement != nil:
     let shadow = parentElement.shadowRoot
     if shadow != nil and shadow.slotAssignment == samNamed and
@@ -3206,28 +3314,145 @@ proc parseSelectors(ctx: JSContext; ds: DOMString): SelectorList =
   if result.len == 0:
     JS_ThrowDOMException(ctx, "SyntaxError", "invalid selector: %s", ds.p)
 
+# Parsed selectors are cached per document.  So are the results of
+# queries whose selectors only depend on the tree and its attributes
+# (i.e. not on :hover, :checked, etc.); invalidateCollections drops these
+# on every mutation that could change them.
+const SelectorCacheMax = 64
+const QueryCacheMax = 16
+
+proc getSelectors(ctx: JSContext; document: Document; q: DOMString;
+    key: string): SelectorList =
+  document.selectorCache.withValue(key, it):
+    return it[]
+  result = ctx.parseSelectors(q)
+  if result.len > 0:
+    if document.selectorCache.len >= SelectorCacheMax:
+      document.selectorCache.clear()
+    document.selectorCache[key] = result
+
+proc isStatic(slist: SelectorList): bool =
+  const StaticPseudoClasses = {pcFirstChild, pcLastChild, pcOnlyChild, pcRoot}
+  for cxsel in slist:
+    for csel in cxsel:
+      for sel in csel:
+        case sel.t
+        of stPseudoClass:
+          if sel.pc notin StaticPseudoClasses:
+            return false
+        of stIs, stWhere, stNot:
+          if not sel.fsels.isStatic():
+            return false
+        of stNthChild, stNthLastChild:
+          if not sel.nthChild.ofsels.isStatic():
+            return false
+        of stLang, stHost:
+          return false
+        of stType, stId, stAttr, stClass, stUniversal:
+          discard
+  true
+
+# Return the selector if slist consists of a single simple selector.
+proc getSimpleSelector(slist: SelectorList): Selector =
+  result = nil
+  if slist.len == 1 and slist[0].len == 1 and slist[0].pseudo == peNone:
+    for sel in slist[0][0]:
+      if result != nil:
+        return nil
+      result = sel
+
+proc findQueryCache(document: Document; root: ParentNode; key: string;
+    all: bool): ptr QueryCacheEntry =
+  for it in document.queryCache.mitems:
+    # querySelector can also use the first result of querySelectorAll
+    if it.root == root and it.query == key and (it.all or not all):
+      return addr it
+  nil
+
+proc addQueryCache(document: Document; root: ParentNode; key: string;
+    all: bool; nodes: seq[Node]) =
+  if document.queryCache.len >= QueryCacheMax:
+    document.queryCache.delete(0)
+  document.queryCache.add(QueryCacheEntry(
+    root: root,
+    query: key,
+    all: all,
+    nodes: nodes
+  ))
+
 proc querySelectorImpl(ctx: JSContext; node: ParentNode; q: DOMString):
     JSValue =
-  let selectors = ctx.parseSelectors(q)
+  let document = node.document
+  let key = $q
+  let cached = document.findQueryCache(node, key, all = false)
+  if cached != nil:
+    if cached.nodes.len > 0:
+      return ctx.toJS(Element(cached.nodes[0]))
+    return JS_NULL
+  let selectors = ctx.getSelectors(document, q, key)
   if selectors.len == 0:
     return JS_EXCEPTION
+  if node of Document and document.mode != qmQuirks:
+    let sel = selectors.getSimpleSelector()
+    if sel != nil and sel.t == stId:
+      let element = document.getElementById(sel.atom)
+      if element != nil:
+        return ctx.toJS(element)
+      return JS_NULL
+  var res: Element = nil
   for element in node.elementDescendants:
     if element.matchesImpl(selectors):
-      return ctx.toJS(element)
+      res = element
+      break
+  if selectors.isStatic():
+    var nodes: seq[Node] = @[]
+    if res != nil:
+      nodes.add(res)
+    document.addQueryCache(node, key, all = false, nodes)
+  if res != nil:
+    return ctx.toJS(res)
   return JS_NULL
 
 proc querySelectorAllImpl(ctx: JSContext; node: ParentNode; q: DOMString):
     JSValue =
-  let selectors = ctx.parseSelectors(q)
+  let document = node.document
+  let key = $q
+  let this = newEmptyNodeList()
+  let cached = document.findQueryCache(node, key, all = true)
+  if cached != nil:
+    this.snapshot = cached.nodes
+    return ctx.toJS(this)
+  let selectors = ctx.getSelectors(document, q, key)
   if selectors.len == 0:
     return JS_EXCEPTION
-  let this = newEmptyNodeList()
   for element in node.elementDescendants:
     if element.matchesImpl(selectors):
       this.snapshot.add(element)
+  if selectors.isStatic():
+    document.addQueryCache(node, key, all = true, this.snapshot)
   return ctx.toJS(this)
 
 # Collection
+# Upper bound on the number of matches, taken from the document's counts.
+# Only known for keyed collections rooted at the document, because the
+# counts do not cover shadow trees and detached subtrees.
+proc matchLimit(this: Collection): int =
+  if this.document == nil or not (this.root of Document):
+    return int.high
+  let document = Document(this.root)
+  case this.key
+  of ckTag:
+    if document.mixedCaseTags == 0:
+      return int(document.tagCounts[this.tagType])
+  of ckClass:
+    if document.mode != qmQuirks:
+      result = int.high
+      for class in this.atoms:
+        result = min(result, int(document.classCounts.getOrDefault(class)))
+      return
+  of ckAny, ckElements: discard
+  return int.high
+
 proc populateCollection(this: Collection) =
   if this.root of ParentNode:
     let root = ParentNode(this.root)
@@ -3236,9 +3461,13 @@ proc populateCollection(this: Collection) =
         if this.match == nil or this.match(this, child):
           this.snapshot.add(child)
     else:
-      for desc in root.descendants:
-        if this.match == nil or this.match(this, desc):
-          this.snapshot.add(desc)
+      let limit = this.matchLimit()
+      if limit > 0:
+        for desc in root.descendants:
+          if this.match == nil or this.match(this, desc):
+            this.snapshot.add(desc)
+            if this.snapshot.len == limit:
+              break
 
 proc refreshCollection(this: Collection) =
   if this.invalid:
@@ -3284,6 +3513,8 @@ proc finalize(document: Document) {.jsfin.} =
   while it != nil:
     it.document = nil
     it = it.next
+  for class in document.classCounts.keys:
+    freeAtom(class)
 
 proc getLength(this: Collection): uint32 =
   this.refreshCollection()
@@ -3578,6 +3809,8 @@ proc forms(ctx: JSContext; document: Document): HTMLCollection {.jsfget.} =
       match = isForm,
       childonly = false
     )
+    document.cachedForms.key = ckTag
+    document.cachedForms.tagType = ttForm
   document.cachedForms
 
 proc links(ctx: JSContext; document: Document): HTMLCollection {.jsfget.} =
@@ -3596,6 +3829,8 @@ proc images(ctx: JSContext; document: Document): HTMLCollection {.jsfget.} =
       match = isImage,
       childonly = false
     )
+    document.cachedImages.key = ckTag
+    document.cachedImages.tagType = ttImg
   document.cachedImages
 
 proc getURL(ctx: JSContext; document: Document): JSValue {.
@@ -3866,21 +4101,94 @@ proc setTitle(ctx: JSContext; document: Document; ds: DOMString) {.
     head.append(title, ctx)
   title.replaceAll(ds, ctx)
 
-proc invalidateCollections(document: Document) =
+proc affectedBy(collection: Collection; change: IndexChange): bool =
+  if change.all:
+    return true
+  case collection.key
+  of ckAny: return true
+  of ckElements: return change.elements
+  of ckTag: return change.allTags or collection.tagType in change.tags
+  of ckClass:
+    if collection.document.mode == qmQuirks:
+      return true # classes match case-insensitively
+    for class in collection.atoms:
+      if class in change.classes:
+        return true
+    return false
+
+proc invalidateCollections(document: Document; change: IndexChange) =
+  document.queryCache.setLen(0)
   var collection = document.liveCollectionsHead
   while collection != nil:
     if collection of Collection:
-      cast[Collection](collection).invalid = true
+      let collection = cast[Collection](collection)
+      if collection.affectedBy(change):
+        collection.invalid = true
     collection = collection.next
 
+proc invalidateCollections(document: Document) =
+  document.invalidateCollections(IndexChange(all: true))
+
+proc updateClassCount(document: Document; class: CAtom; n: int32) =
+  let count = document.classCounts.getOrDefault(class) + n
+  if count > 0:
+    if class notin document.classCounts:
+      discard class.dup()
+    document.classCounts[class] = count
+  elif class in document.classCounts:
+    document.classCounts.del(class)
+    freeAtom(class)
+
+proc updateIndex(document: Document; element: Element; n: int32;
+    change: var IndexChange) =
+  let tagType = element.tagTypeNoNS
+  document.tagCounts[tagType] += n
+  change.elements = true
+  change.tags.incl(tagType)
+  if element.namespaceURI == satNamespaceHTML and
+      AsciiUpperAlpha in element.localName:
+    # matched case-insensitively by collections of other tag types
+    document.mixedCaseTags += n
+    change.allTags = true
+  let classList = element.classList
+  if n > 0:
+    classList.indexed = classList.toks
+  for class in classList.indexed:
+    document.updateClassCount(class, n)
+    change.classes.add(class)
+  if n < 0:
+    classList.indexed.setLen(0)
+
+# Count node and its descendants in (n = 1) or out of (n = -1) the
+# document's indexes.  node must be connected, outside shadow trees.
+proc updateIndex(document: Document; node: Node; n: int32;
+    change: var IndexChange) =
+  if node of Element:
+    let element = Element(node)
+    document.updateIndex(element, n, change)
+    for desc in element.elementDescendants:
+      document.updateIndex(desc, n, change)
+
+# node has been inserted into document (not into a shadow tree).
+proc invalidateCollectionsInsert(document: Document; node: Node) =
+  var change = IndexChange()
+  document.updateIndex(node, 1, change)
+  document.invalidateCollections(change)
+
 proc invalidateCollectionsRemove(document: Document; node: Node) =
   # node will be removed
+  var change = IndexChange(all: node.rootNode != document)
+  if not change.all:
+    document.updateIndex(node, -1, change)
+  document.queryCache.setLen(0)
   var collection = document.liveCollectionsHead
   while collection != nil:
     if cast[CollectionLike](collection) of NodeIterator:
       cast[NodeIterator](collection).adjustForRemoval(node)
     elif cast[CollectionLike](collection) of Collection:
-      cast[Collection](collection).invalid = true
+      let collection = cast[Collection](collection)
+      if collection.affectedBy(change):
+        collection.invalid = true
     collection = collection.next
 
 proc isValidCustomElementName(atom: CAtomTraced): bool =
@@ -4202,40 +4510,82 @@ proc reflectEvent(document: Document; target: EventTarget;
     JS_FreeValue(ctx, res)
     JS_FreeValue(ctx, fun)
 
-proc applyUASheet*(document: Document) =
-  const ua = staticRead"res/ua.css"
-  let sheet = parseStylesheet(ua, nil, addr document.window.settings,
-    coUserAgent, CAtomNullTraced)
-  document.uaSheetsHead = sheet
-  if document.documentElement != nil:
-    document.documentElement.invalidate()
+var uaSheetsCache: seq[UASheets] = @[]
 
-proc applyQuirksSheet*(document: Document) =
-  if document.window == nil:
-    return
+proc getUASheets(settings: EnvironmentSettings; user: string): UASheets =
+  for it in uaSheetsCache:
+    if it.attrs == settings.attrsp[] and
+        it.settings.scripting == settings.scripting and
+        it.settings.headless == settings.headless and
+        it.settings.contentType == settings.contentType and it.user == user:
+      return it
+  const ua = staticRead"res/ua.css"
   const quirks = staticRead"res/quirk.css"
-  let sheet = parseStylesheet(quirks, nil, addr document.window.settings,
-    coUserAgent, CAtomNullTraced)
-  document.uaSheetsHead.next = sheet
-  sheet.prev = document.uaSheetsHead
+  let it = UASheets(attrs: settings.attrsp[], user: user)
+  it.settings = EnvironmentSettings(
+    attrsp: addr it.attrs,
+    scriptAttrsp: addr it.attrs,
+    scripting: settings.scripting,
+    headless: settings.headless,
+    contentType: settings.contentType.dup()
+  )
+  let settingsp = addr it.settings
+  it.ua = parseStylesheet(ua, nil, settingsp, coUserAgent, CAtomNullTraced)
+  it.quirks = parseStylesheet(quirks, nil, settingsp, coUserAgent,
+    CAtomNullTraced)
+  it.userSheet = parseStylesheet(user, nil, settingsp, coUser, CAtomNullTraced)
+  # The quirks sheet goes last, so that rules keep the same sheet ids in
+  # both maps.
+  for quirksMode in bool:
+    let map = newCSSRuleMap(quirksMode)
+    map.add(it.ua)
+    map.add(it.userSheet)
+    if quirksMode:
+      map.add(it.quirks)
+    it.maps[quirksMode] = map
+  # Typically, there is only one environment per buffer (and only a few in
+  # the fork server), so a short list will do.
+  if uaSheetsCache.len >= 4:
+    freeAtom(uaSheetsCache[0].settings.contentType)
+    uaSheetsCache.delete(0)
+  uaSheetsCache.add(it)
+  it
+
+# Called by the fork server with the parameters of a buffer it is about to
+# fork.
+proc prepareUASheets*(attrs: WindowAttributes; scripting: ScriptingMode;
+    headless: HeadlessMode; contentType, user: string) =
+  var attrs = attrs
+  let settings = EnvironmentSettings(
+    attrsp: addr attrs,
+    scripting: scripting,
+    headless: headless,
+    contentType: contentType.toAtom()
+  )
+  discard settings.getUASheets(user)
+  freeAtom(settings.contentType)
+
+proc applyUASheet*(document: Document; user: string) =
+  document.uaSheets = document.window.settings.getUASheets(user)
+  document.ruleMap = nil
   if document.documentElement != nil:
     document.documentElement.invalidate()
 
-proc applyUserSheet*(document: Document; user: string) =
-  document.userSheet = parseStylesheet(user, nil,
-    addr document.window.settings, coUser, CAtomNullTraced)
+proc applyQuirksSheet*(document: Document) =
+  # getRuleMap picks the user agent rules with the quirks sheet by mode
+  document.ruleMap = nil
   if document.documentElement != nil:
     document.documentElement.invalidate()
 
 proc getRuleMap*(document: Document): CSSRuleMap =
   if document.ruleMap == nil:
-    let map = newCSSRuleMap(document.mode == qmQuirks)
-    var sheet = document.uaSheetsHead
-    while sheet != nil:
-      map.add(sheet)
-      sheet = sheet.next
-    map.add(document.userSheet)
-    sheet = document.authorSheetsHead
+    let quirks = document.mode == qmQuirks
+    let ua = if document.uaSheets != nil:
+      document.uaSheets.maps[quirks]
+    else:
+      nil
+    let map = newCSSRuleMap(quirks, ua)
+    var sheet = document.authorSheetsHead
     while sheet != nil:
       if not sheet.disabled and sheet.applies:
         map.add(sheet)
@@ -5850,9 +6200,50 @@ proc reflectAttr0(element: Element; name: CAtomTraced; has: bool;
 
 proc reflectAttr(element: Element; name: CAtomTraced; has: bool;
     value: string) =
-  element.reflectAttr0(name, has, value)
-  element.document.invalidateCollections()
-  element.invalidate()
+  let document = element.document
+  let sname = name.toStaticAtom()
+  # Only look up what the change affects if the element has been styled
+  # with the current rules; otherwise, restyle the whole subtree.
+  let map = if element.computed != nil and element.rootNode == document:
+    document.ruleMap
+  else:
+    nil
+  var iset = InvalidationSet()
+  if map != nil:
+    let lower = name.toLowerAscii()
+    map.getInvalidationSet(ifkAttr, lower.view(), iset)
+    if sname == satId:
+      map.getInvalidationSet(ifkId, element.id, iset)
+    elif sname != satClass: # presentational hints, style attribute
+      iset.flags.incl(ifSelf)
+  if sname != satClass:
+    element.reflectAttr0(name, has, value)
+    # only match functions that look at attributes are affected
+    document.invalidateCollections(IndexChange())
+    if map != nil and sname == satId:
+      map.getInvalidationSet(ifkId, element.id, iset)
+  elif element.rootNode == document:
+    let classList = element.classList
+    let old = move(classList.indexed)
+    element.reflectAttr0(name, has, value)
+    classList.indexed = classList.toks
+    let change = IndexChange(classes: classList.indexed & old)
+    for class in classList.indexed:
+      document.updateClassCount(class, 1)
+      if map != nil and class notin old:
+        map.getInvalidationSet(ifkClass, class, iset)
+    for class in old:
+      document.updateClassCount(class, -1)
+      if map != nil and class notin classList.indexed:
+        map.getInvalidationSet(ifkClass, class, iset)
+    document.invalidateCollections(change)
+  else:
+    element.reflectAttr0(name, has, value)
+    document.invalidateCollections()
+  if map != nil:
+    element.invalidate(iset)
+  else:
+    element.invalidate()
 
 proc reflectAttrDel(element: Element; name: CAtomTraced) =
   element.reflectAttr(name, false, "")
@@ -6125,15 +6516,86 @@ proc invalidate*(element: Element) =
     var skip = false
     if node of Element:
       let desc = Element(node)
-      skip = desc.computed == nil or efRestyle in desc.flags
-      desc.flags.incl(efRestyle)
+      skip = desc.computed == nil or efRestyleSubtree in desc.flags
+      desc.flags.incl({efRestyle, efRestyleSubtree})
     node = node.nextDescendant(Node(element), skip)
 
-proc ensureStyle*(element: Element) =
+# Restyle the element's children.  Called by the cascade when the
+# element's computed values change, since the children may inherit them.
+proc restyleChildren*(element: Element) =
+  for child in element.elementList:
+    if child.computed != nil:
+      child.flags.incl(efRestyle)
+
+proc matches(element: Element; iset: InvalidationSet; quirks: bool): bool =
+  if element.localName in iset.tags:
+    return true
+  if element.id != satUempty:
+    if quirks and iset.ids.containsIgnoreCase(element.id) or
+        not quirks and element.id in iset.ids:
+      return true
+  if iset.classes.len > 0:
+    for class in element.classList.toks:
+      if quirks and iset.classes.containsIgnoreCase(class) or
+          not quirks and class in iset.classes:
+        return true
+  false
+
+# Restyle the elements that a change on `element' may affect, as
+# described by `iset' (see getInvalidationSet).
+proc invalidate(element: Element; iset: InvalidationSet) =
+  let document = element.document
+  document.invalid = true
+  if ifParent in iset.flags:
+    let parent = element.parentElement
+    (if parent != nil: parent else: element).invalidate()
+    return
+  if ifSubtree in iset.flags:
+    element.invalidate()
+  else:
+    if ifSelf in iset.flags:
+      element.flags.incl(efRestyle)
+    if iset.tags.len + iset.classes.len + iset.ids.len > 0:
+      let quirks = document.mode == qmQuirks
+      var node = element.firstChild
+      while node != nil:
+        var skip = false
+        if node of Element:
+          let desc = Element(node)
+          skip = desc.computed == nil or efRestyleSubtree in desc.flags
+          if not skip and desc.matches(iset, quirks):
+            desc.flags.incl(efRestyle)
+        node = node.nextDescendant(Node(element), skip)
+  if ifSiblings in iset.flags:
+    var sibling = element.nextElementSibling
+    while sibling != nil:
+      sibling.invalidate()
+      sibling = sibling.nextElementSibling
+
+# Restyle the element if needed, assuming that its ancestors are up to
+# date (e.g. because we are building the tree top-down).
+proc ensureOwnStyle*(element: Element) =
   if element.computed == nil or efRestyle in element.flags:
-    element.flags.excl(efRestyle)
+    element.flags.excl({efRestyle, efRestyleSubtree})
     element.applyStyleImpl()
 
+proc ensureStyle*(element: Element) =
+  # Restyling an ancestor may mark its children (see restyleChildren), so
+  # ancestors that need it are restyled first.
+  var top: Element = nil
+  for it in element.ancestors:
+    if it.computed == nil or efRestyle in it.flags:
+      top = it
+  if top != nil:
+    var path: seq[Element] = @[]
+    for it in element.ancestors:
+      path.add(it)
+      if it == top:
+        break
+    for i in countdown(path.high, 0):
+      path[i].ensureOwnStyle()
+  element.ensureOwnStyle()
+
 proc resetElement*(element: Element; ctx: JSContext) =
   case element.tagType
   of ttInput:
@@ -1,5 +1,7 @@
 {.push raises: [].}
 
+import std/tables
+
 import config/conftypes
 import config/mimetypes
 import css/cssparser
@@ -187,16 +189,29 @@ proc pushState(ctx: JSContext; history: History; data: JSValueConst;
   return JS_UNDEFINED
 
 # Storage
+# Persistent storage is read from the loader on first use, so buffers that
+# never touch localStorage do not pay for it.
+proc load(this: Storage) =
+  if this.loader != nil and not this.loaded:
+    this.loaded = true
+    var items: seq[tuple[key, value: string]] = @[]
+    if this.loader.getStorage(items).isErr:
+      this.loader = nil
+    for it in items.mitems:
+      this.size += it.key.len + it.value.len
+      this.index[it.key] = this.map.len
+      this.map.add((move(it.key), move(it.value)))
+
 proc find(this: Storage; key: DOMString): int =
-  for i in 0 ..< this.map.len:
-    if this.map[i].key == key.toOpenArray():
-      return i
-  return -1
+  this.load()
+  return this.index.getOrDefault($key, -1)
 
 proc length(this: Storage): uint32 {.jsfget.} =
+  this.load()
   return uint32(this.map.len)
 
 proc key(ctx: JSContext; this: Storage; u: uint32): JSValue {.jsfunc.} =
+  this.load()
   if u < uint32(this.map.len):
     return ctx.toJS(this.map[int(u)].key)
   return JS_NULL
@@ -210,18 +225,49 @@ proc getItem(ctx: JSContext; this: Storage; s: DOMString): JSValue {.jsfunc.} =
 proc setItem(ctx: JSContext; this: Storage; key, value: DOMString): JSValue
     {.jsfunc.} =
   let i = this.find(key)
+  let value = $value
   if i != -1:
-    this.map[i].value = $value
+    if this.map[i].value == value:
+      return JS_UNDEFINED
+    let size = this.size - this.map[i].value.len + value.len
+    if size > StorageQuota:
+      return JS_ThrowDOMException(ctx, "QuotaExceededError", "quota exceeded")
+    this.size = size
+    if this.loader != nil:
+      this.loader.updateStorage(soSet, this.map[i].key, value)
+    this.map[i].value = value
   else:
-    if this.map.len >= 64:
+    let key = $key
+    let size = this.size + key.len + value.len
+    if size > StorageQuota:
       return JS_ThrowDOMException(ctx, "QuotaExceededError", "quota exceeded")
-    this.map.add(($key, $value))
+    this.size = size
+    if this.loader != nil:
+      this.loader.updateStorage(soSet, key, value)
+    this.index[key] = this.map.len
+    this.map.add((key, value))
   return JS_UNDEFINED
 
 proc removeItem(this: Storage; key: DOMString) {.jsfunc.} =
   let i = this.find(key)
   if i != -1:
+    let key = move(this.map[i].key)
+    this.size -= key.len + this.map[i].value.len
+    this.index.del(key)
+    if this.loader != nil:
+      this.loader.updateStorage(soRemove, key, "")
     this.map.del(i)
+    if i < this.map.len: # del moved the last item here
+      this.index[this.map[i].key] = i
+
+proc clear(this: Storage) {.jsfunc.} =
+  this.load()
+  if this.map.len > 0:
+    if this.loader != nil:
+      this.loader.updateStorage(soClear, "", "")
+    this.map.setLen(0)
+    this.index.clear()
+    this.size = 0
 
 proc names(ctx: JSContext; this: Storage): JSPropertyEnumList
     {.jspropnames.} =
@@ -706,62 +752,82 @@ proc addScripting*(window: Window; ctx: JSContext): Opt[void] =
   JS_FreeValue(ctx, weakMap)
   JS_FreeValue(ctx, jsWindow)
   JS_SetModuleLoaderFunc(rt, normalizeModuleName, loadJSModule, nil)
-  window.performance = newPerformance(window.settings.scripting)
-  if window.settings.scripting == smApp:
-    window.settings.scriptAttrsp = window.settings.attrsp
-  else:
-    window.settings.scriptAttrsp = unsafeAddr dummyAttrs
   ctx.addCommonModules(window)
 
+# Create a window with a JS context that already has every binding
+# registered, but no settings or document.  The fork server keeps one of
+# these in a template process, and forks buffers from it; newWindow then
+# finishes the initialization.
+proc newScriptingWindow*(): Window =
+  let window = Window(console: newConsole(cast[ChaFile](stderr)))
+  for it in window.weakMap.mitems:
+    it = JS_UNDEFINED
+  let rt = newGlobalJSRuntime()
+  let ctx = rt.newJSContext()
+  if window.addScripting(ctx).isErr:
+    window.console.error("failed to initialize JS")
+    window.console.writeException(ctx)
+    quit(1)
+  var globalExotic {.global.} = JSClassExoticMethods(
+    define_own_property: windowDefineOwnProperty,
+    #TODO get_own_property, get, set, delete, own property keys
+    set_prototype: windowSetPrototype,
+    is_extensible: windowIsExtensible,
+    prevent_extensions: windowPreventExtensions,
+  )
+  JS_SetGlobalExotic(ctx, addr globalExotic)
+  return window
+
+# If `prewarmed' is not nil, it must come from newScriptingWindow.
 proc newWindow*(scripting: ScriptingMode; images, styling, autofocus: bool;
     headless: HeadlessMode; attrsp: ptr WindowAttributes; loader: FileLoader;
     url: URL; urandom: PosixStream; imageTypes: MimeTypesImages;
-    userAgent, referrer, contentType: string): Window =
-  let window = Window(
-    console: newConsole(cast[ChaFile](stderr)),
-    navigator: Navigator(
-      plugins: PluginArray(),
-      mimeTypes: MimeTypeArray(),
-      permissions: Permissions()
-    ),
-    loader: loader,
-    settings: EnvironmentSettings(
-      attrsp: attrsp,
-      styling: styling,
-      scripting: scripting,
-      origin: url.origin,
-      images: images,
-      autofocus: autofocus,
-      headless: headless,
-      contentType: contentType.toAtom()
-    ),
-    crypto: Crypto(urandom: urandom),
-    imageTypes: imageTypes,
-    userAgent: userAgent,
-    referrer: referrer,
-    screen: Screen(),
-    history: History(),
-    localStorage: Storage(),
-    sessionStorage: Storage(),
+    userAgent, referrer, contentType: string; prewarmed: Window = nil):
+    Window =
+  let window = if prewarmed != nil:
+    assert scripting != smFalse
+    prewarmed
+  elif scripting != smFalse:
+    newScriptingWindow()
+  else:
+    Window(console: newConsole(cast[ChaFile](stderr)))
+  window.navigator = Navigator(
+    plugins: PluginArray(),
+    mimeTypes: MimeTypeArray(),
+    permissions: Permissions()
   )
+  window.loader = loader
+  window.settings = EnvironmentSettings(
+    attrsp: attrsp,
+    styling: styling,
+    scripting: scripting,
+    origin: url.origin,
+    images: images,
+    autofocus: autofocus,
+    headless: headless,
+    contentType: contentType.toAtom()
+  )
+  window.crypto = Crypto(urandom: urandom)
+  window.imageTypes = imageTypes
+  window.userAgent = userAgent
+  window.referrer = referrer
+  window.screen = Screen()
+  window.history = History()
+  window.localStorage = Storage(loader: loader)
+  window.sessionStorage = Storage()
   window.location = window.newLocation()
-  for it in window.weakMap.mitems:
-    it = JS_UNDEFINED
   if scripting != smFalse:
-    let rt = newGlobalJSRuntime()
-    let ctx = rt.newJSContext()
-    if window.addScripting(ctx).isErr:
-      window.console.error("failed to initialize JS")
-      window.console.writeException(ctx)
-      quit(1)
-    var globalExotic {.global.} = JSClassExoticMethods(
-      define_own_property: windowDefineOwnProperty,
-      #TODO get_own_property, get, set, delete, own property keys
-      set_prototype: windowSetPrototype,
-      is_extensible: windowIsExtensible,
-      prevent_extensions: windowPreventExtensions,
-    )
-    JS_SetGlobalExotic(ctx, addr globalExotic)
+    # a prewarmed window may have been forked long after it was created,
+    # so the time origin and the Math.random seed must be set here
+    window.performance = newPerformance(scripting)
+    JS_ResetRandomSeed(window.jsctx)
+    if scripting == smApp:
+      window.settings.scriptAttrsp = attrsp
+    else:
+      window.settings.scriptAttrsp = unsafeAddr dummyAttrs
+  else:
+    for it in window.weakMap.mitems:
+      it = JS_UNDEFINED
   return window
 
 # Forward declaration hack
@@ -1,5 +1,8 @@
 {.push raises: [].}
 
+import std/hashes
+import std/tables
+
 import config/conftypes
 import html/catom
 import monoucha/jsutils
@@ -61,6 +64,7 @@ type
     images*: bool
     styling*: bool
     autofocus*: bool
+    scriptCache*: bool
     contentType*: CAtom
 
   Script* = ref object
@@ -173,9 +177,86 @@ proc moduleTypeToRequestDest*(moduleType: ModuleType;
     return rdStyle
   return default
 
+# Compiling small scripts is cheaper than looking them up.
+const ScriptCacheMinSize = 4096
+const ScriptCacheMaxSize = 16 * 1024 * 1024 # bytes
+# Cached entries (bytecode, style sheet tokens) are only valid for the
+# build that wrote them.
+const ParseCacheBuildId = CompileDate & ' ' & CompileTime
+
+proc addHex(s: var string; u: uint64) =
+  for i in countdown(7, 0):
+    s.pushHex(uint8(u shr (i * 8)))
+
+# Key of `source' in the loader's parse caches.  `salt' distinguishes
+# entries that are parsed differently from the same source.
+proc getParseCacheKey*(source, salt: string): string =
+  var key = ""
+  key.addHex(uint64(hash(source)))
+  key.addHex(uint64(hash(salt & '\0' & ParseCacheBuildId)))
+  key.addHex(uint64(source.len))
+  move(key)
+
+proc getScriptCacheKey(source, name: string; module: bool): string =
+  getParseCacheKey(source, name & '\0' & $module)
+
+# Bytecode of the scripts this process has compiled, oldest first.
+# QuickJS does not verify bytecode before running it, so it is never
+# shared with other processes: bytecode written by a compromised buffer
+# could do anything in the buffers that load it.
+var scriptCache = initOrderedTable[string, string]()
+var scriptCacheSize = 0
+
+proc putScriptCache(key: string; bytecode: openArray[char]) =
+  if bytecode.len > ScriptCacheMaxSize:
+    return
+  var s = newString(bytecode.len)
+  copyMem(addr s[0], unsafeAddr bytecode[0], bytecode.len)
+  scriptCacheSize += s.len
+  scriptCache[key] = move(s)
+  while scriptCacheSize > ScriptCacheMaxSize:
+    var oldest = ""
+    for it in scriptCache.keys:
+      oldest = it
+      break
+    var old: string
+    discard scriptCache.pop(oldest, old)
+    scriptCacheSize -= old.len
+
+# Compile `source', or load its bytecode from the script cache if it was
+# compiled before.
+proc compileCached(ctx: JSContext; source, name: string; module: bool):
+    JSValue =
+  let settings = ctx.getEnvSettingsImpl()
+  if source.len < ScriptCacheMinSize or settings == nil or
+      not settings.scriptCache:
+    if module:
+      return ctx.compileModule(source, name)
+    return ctx.compileScript(source, name)
+  let key = getScriptCacheKey(source, name, module)
+  scriptCache.withValue(key, bytecode):
+    let val = JS_ReadObject(ctx, cast[ptr uint8](addr bytecode[][0]),
+      csize_t(bytecode[].len), JS_READ_OBJ_BYTECODE)
+    if not JS_IsException(val):
+      return val
+    JS_FreeValue(ctx, JS_GetException(ctx))
+  let val = if module:
+    ctx.compileModule(source, name)
+  else:
+    ctx.compileScript(source, name)
+  if not JS_IsException(val) and key notin scriptCache:
+    var plen: csize_t
+    let p = cast[ptr UncheckedArray[char]](
+      JS_WriteObject(ctx, addr plen, val, JS_WRITE_OBJ_BYTECODE))
+    if p != nil:
+      if plen > 0:
+        putScriptCache(key, p.toOpenArray(0, int(plen) - 1))
+      js_free(ctx, p)
+  return val
+
 proc newClassicScript*(ctx: JSContext; source: string; baseURL: URL;
     options: ScriptOptions; mutedErrors = false): ScriptResult =
-  let record = ctx.compileScript(source, $baseURL)
+  let record = ctx.compileCached(source, $baseURL, module = false)
   return ScriptResult(
     t: srtScript,
     script: Script(
@@ -189,7 +270,7 @@ proc newClassicScript*(ctx: JSContext; source: string; baseURL: URL;
 
 proc newJSModuleScript*(ctx: JSContext; source: string; baseURL: URL;
     options: ScriptOptions): ScriptResult =
-  let record = ctx.compileModule(source, $baseURL)
+  let record = ctx.compileCached(source, $baseURL, module = true)
   return ScriptResult(
     t: srtScript,
     script: Script(
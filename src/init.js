@@ -243,9 +243,10 @@ for (const it of ["cursorLeft", "cursorDown", "cursorUp", "cursorRight",
 for (const it of ["redraw", "cancel", "toggleSource", "nextBuffer",
         "prevBuffer", "lineInfo", "discardBuffer", "discardBufferTree",
         "searchForward", "searchBackward", "isearchForward", "isearchBackward",
-        "discardTree", "dupeBuffer", "load", "loadCursor", "saveLink",
+        "searchAll", "discardTree", "dupeBuffer", "load", "loadCursor", "saveLink",
         "toggleImages", "writeInputBuffer", "showFullAlert", "toggleLinkHints",
-        "peek", "peekCursor", "quit", "suspend"]) {
+        "peek", "peekCursor", "showMemoryUsage", "showReshapeStats", "quit",
+        "suspend"]) {
     cmd[it] = () => pager[it]();
 }
 
@@ -325,6 +326,8 @@ Pager.prototype.init = function(pages, contentType, charset, history, pipe) {
         downloads: null,
         console: null,
         prev: null,
+        memory: null,
+        reshape: null,
     };
     this.navDirection = "prev"; /* "prev", "next", "any" */
     this.mouse = new Mouse();
@@ -364,6 +367,14 @@ Pager.prototype.init = function(pages, contentType, charset, history, pipe) {
                     this.handleStderr(); /* dump errors */
                     break loop;
                 }
+                if (config.start.reshapeStats) {
+                    const stats = buffer.iface.getReshapeStatsSync();
+                    if (stats != null) {
+                        console.error(JSON.stringify(Object.assign({
+                            url: buffer.url + ""
+                        }, stats)));
+                    }
+                }
                 buffer = buffer.next
             }
             tab = tab.next;
@@ -540,6 +551,7 @@ Pager.prototype.searchForward = async function(reverse = false) {
     if (text != "") {
         try {
             this.regex = this.compileSearchRegex(text);
+            this.buffer?.iface?.clearMatchIndex();
         } catch (e) {
             this.alert("Invalid regex: " + e.message);
         }
@@ -548,6 +560,33 @@ Pager.prototype.searchForward = async function(reverse = false) {
     this.searchNext();
 }
 
+/* public */
+Pager.prototype.searchAll = async function() {
+    const text = await this.setLineEdit("search", "/");
+    if (text == null)
+        return;
+    if (text != "") {
+        try {
+            this.regex = this.compileSearchRegex(text);
+        } catch (e) {
+            this.alert("Invalid regex: " + e.message);
+            return;
+        }
+    }
+    const iface = this.buffer?.iface;
+    if (!this.regex || iface == null)
+        return this.searchNext();
+    this.reverseSearch = false;
+    const n = await iface.findAllMatches(this.regex);
+    if (n == 0)
+        this.alert("No matches");
+    else {
+        if (n < 0)
+            this.alert("Too many matches to index");
+        this.searchNext();
+    }
+}
+
 /* public */
 Pager.prototype.searchBackward = function() {
     return this.searchForward(true);
@@ -605,8 +644,10 @@ Pager.prototype.isearchForward = async function(reverse = false) {
                 if (text != "") {
                     if (typeof this.iregex === "string")
                         this.alert("Invalid regex: " + this.iregex);
-                    else
+                    else {
                         this.regex = this.iregex;
+                        buffer.iface?.clearMatchIndex();
+                    }
                 } else
                     this.searchNext()
                 this.reverseSearch = reverse;
@@ -633,6 +674,69 @@ Pager.prototype.showFullAlert = function() {
         this.setLineEdit("alert", "", {current: str});
 }
 
+/*
+ * Collect a row from each buffer with getRow, and open the rows as a
+ * plain-text table in the pinned buffer `pin'.
+ */
+/* private */
+Pager.prototype.showBufferTable = async function(pin, title, header, getRow) {
+    const rows = [header];
+    for (let tab = this.tabHead; tab != null; tab = tab.next) {
+        for (let buffer = tab.head; buffer != null; buffer = buffer.next) {
+            const iface = buffer.iface;
+            if (iface == null || buffer == this.pinned[pin])
+                continue;
+            const row = await getRow(buffer, iface);
+            rows.push(row.concat([buffer.url + ""]).map(x => x + ""));
+        }
+    }
+    const widths = rows[0].map((_, i) => Math.max(...rows.map(
+        row => row[i].length)));
+    const text = rows.map(row => row.map((x, i) => i == row.length - 1 ?
+        x : x.padStart(widths[i])).join("  ")).join("\n") + "\n";
+    const old = this.pinned[pin];
+    const buffer = this.gotoURL("data:," + encodeURIComponent(text), {
+        contentType: "text/plain",
+        title,
+        history: false,
+        replace: old
+    });
+    if (buffer != null && old != null)
+        this.setBuffer(buffer);
+    this.pinned[pin] = buffer;
+}
+
+/* Open a table of each buffer process' memory usage. */
+/* public */
+Pager.prototype.showMemoryUsage = function() {
+    const size = n => n < 0 ? "-" : (n / 1024).toFixed() + "K";
+    return this.showBufferTable("memory", "Memory usage", ["PID", "JS",
+        "JS limit", "GC at", "objects", "nodes", "elements", "styles", "lines",
+        "grid", "heap", "URL"], async (buffer, iface) => {
+        const s = await iface.getMemoryStats();
+        return [buffer.process, size(s.jsMallocSize), size(s.jsMallocLimit),
+            size(s.jsGcThreshold), s.jsObjects, s.nodes, s.elements, s.styles,
+            s.lines, size(s.gridBytes), size(s.heapBytes)];
+    });
+}
+
+/* Open a table of the time each buffer spent in its last reshape. */
+/* public */
+Pager.prototype.showReshapeStats = function() {
+    const ms = n => (n / 1e6).toFixed(1) + "ms";
+    return this.showBufferTable("reshape", "Reshape statistics", ["PID",
+        "reshapes", "style", "tree", "layout", "render", "styled", "shared",
+        "boxes", "kept", "lines", "parse", "sent", "RSS", "URL"],
+        async (buffer, iface) => {
+        const s = await iface.getReshapeStats();
+        return [buffer.process, s.reshapes, ms(s.styleNs), ms(s.treeNs),
+            ms(s.layoutNs), ms(s.renderNs), s.styled, s.styleShared, s.boxes,
+            s.boxesKept, s.lines, ms(s.parseNs),
+            (s.bytesSent / 1024).toFixed() + "K",
+            (s.maxRss / 1024).toFixed(1) + "M"];
+    });
+}
+
 /* private */
 Pager.prototype.setTab = function(buffer, tab) {
     const removed = buffer.setTab(tab);
@@ -1973,6 +2077,8 @@ const ReTextStart = /\S/gu;
                         pager.setVisibleBuffer(this);
                     this.#setVisible();
                     await this.iface.onReshape();
+                    if (this.iface.hasMatchIndex)
+                        await this.iface.refreshMatchIndex();
                     await this.iface.requestLines(true);
                 }
             })();
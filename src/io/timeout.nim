@@ -1,6 +1,6 @@
 {.push raises: [].}
 
-import std/algorithm
+import std/tables
 import std/times
 
 import io/console
@@ -16,6 +16,7 @@ type
   TimeoutEntry = ref object
     t: TimeoutType
     id: int32
+    index: int # position in the heap, or -1 if not in the heap
     val: JSValue
     args: seq[JSValue]
     expires: int64
@@ -24,10 +25,13 @@ type
 
   EvalJSFree* = proc(opaque: RootRef; src, file: string) {.nimcall, raises: [].}
 
+  # Pending timeouts are kept in a binary min-heap ordered by expiry, and
+  # each entry knows its position in the heap, so that clearing a timeout
+  # is a table lookup and a removal in O(log n).
   TimeoutState* = ref object
     timeoutid: int32
-    sorted: bool
-    timeouts: seq[TimeoutEntry]
+    heap: seq[TimeoutEntry]
+    map: Table[int32, TimeoutEntry] # id -> entry
     jsctx: JSContext
     jsrt: JSRuntime
     evalJSFree: EvalJSFree
@@ -39,27 +43,73 @@ proc newTimeoutState*(jsctx: JSContext; evalJSFree: EvalJSFree;
     jsrt: JS_GetRuntime(jsctx),
     jsctx: jsctx,
     evalJSFree: evalJSFree,
-    opaque: opaque,
-    sorted: true
+    opaque: opaque
   )
 
 proc empty*(state: TimeoutState): bool =
-  return state.timeouts.len == 0
-
-proc clearTimeout0(state: var TimeoutState; i: int) =
-  let entry = state.timeouts[i]
+  return state.map.len == 0
+
+# Entries that expire at the same time run in the order they were set.
+proc before(a, b: TimeoutEntry): bool =
+  return a.expires < b.expires or a.expires == b.expires and a.id < b.id
+
+proc swapEntries(state: TimeoutState; i, j: int) =
+  swap(state.heap[i], state.heap[j])
+  state.heap[i].index = i
+  state.heap[j].index = j
+
+proc siftUp(state: TimeoutState; i: int) =
+  var i = i
+  while i > 0:
+    let parent = (i - 1) div 2
+    if not state.heap[i].before(state.heap[parent]):
+      break
+    state.swapEntries(i, parent)
+    i = parent
+
+proc siftDown(state: TimeoutState; i: int) =
+  var i = i
+  while true:
+    var min = i
+    let left = i * 2 + 1
+    let right = left + 1
+    if left < state.heap.len and state.heap[left].before(state.heap[min]):
+      min = left
+    if right < state.heap.len and state.heap[right].before(state.heap[min]):
+      min = right
+    if min == i:
+      break
+    state.swapEntries(i, min)
+    i = min
+
+proc push(state: TimeoutState; entry: TimeoutEntry) =
+  entry.index = state.heap.len
+  state.heap.add(entry)
+  state.siftUp(entry.index)
+
+proc remove(state: TimeoutState; i: int): TimeoutEntry =
+  result = state.heap[i]
+  result.index = -1
+  let last = state.heap.pop()
+  if i < state.heap.len:
+    state.heap[i] = last
+    last.index = i
+    state.siftDown(i)
+    state.siftUp(last.index)
+
+proc free(state: TimeoutState; entry: TimeoutEntry) =
   let rt = state.jsrt
   JS_FreeValueRT(rt, entry.val)
   rt.freeValues(entry.args)
-  state.timeouts.del(i)
-  if state.timeouts.len != i: # only set if we del'd in the middle
-    state.sorted = false
 
 proc clearTimeout*(state: var TimeoutState; id: int32) =
-  for entry in state.timeouts:
-    if entry.id == id:
-      entry.dead = true
-      break
+  var entry: TimeoutEntry
+  if state.map.pop(id, entry):
+    entry.dead = true
+    if entry.index != -1:
+      discard state.remove(entry.index)
+      state.free(entry)
+    # else it is being run; run frees it afterwards
 
 proc getUnixMillis*(): int64 =
   let now = getTime()
@@ -78,8 +128,8 @@ proc setTimeout*(state: var TimeoutState; t: TimeoutType; handler: JSValueConst;
   )
   for arg in args:
     entry.args.add(JS_DupValueRT(state.jsrt, arg))
-  state.timeouts.add(entry)
-  state.sorted = false
+  state.map[id] = entry
+  state.push(entry)
   return id
 
 proc runEntry(state: var TimeoutState; entry: TimeoutEntry; console: Console) =
@@ -95,47 +145,44 @@ proc runEntry(state: var TimeoutState; entry: TimeoutEntry; console: Console) =
       state.evalJSFree(state.opaque, s, $entry.t)
 
 # for poll
-proc sortAndGetTimeout*(state: var TimeoutState): cint =
-  if state.timeouts.len == 0:
+proc getTimeout*(state: TimeoutState): cint =
+  if state.heap.len == 0:
     return -1
-  if not state.sorted:
-    state.timeouts.sort(proc(a, b: TimeoutEntry): int =
-      cmp(a.expires, b.expires), order = Descending)
-    state.sorted = true
   let now = getUnixMillis()
-  return cint(max(state.timeouts[^1].expires - now, -1))
+  return cint(max(state.heap[0].expires - now, -1))
 
 proc run*(state: var TimeoutState; console: Console): bool =
   let now = getUnixMillis()
-  var found = false
-  var H = state.timeouts.high
-  for i in countdown(H, 0):
-    if state.timeouts[i].expires > now:
-      break
-    let entry = state.timeouts[i]
+  # Take every expired entry off the heap before running any of them, so
+  # that rescheduled intervals and timeouts set by the handlers only run
+  # in the next iteration.
+  var due: seq[TimeoutEntry] = @[]
+  while state.heap.len > 0 and state.heap[0].expires <= now:
+    due.add(state.remove(0))
+  for entry in due:
+    # the entry may have been cleared by a previous handler
+    if not entry.dead:
+      state.runEntry(entry, console)
+  for entry in due:
     if entry.dead:
-      continue
-    state.runEntry(entry, console)
-    found = true
-    case entry.t
-    of ttTimeout:
-      entry.dead = true
-    of ttInterval:
-      entry.expires = now + entry.timeout
-      state.sorted = false
-  # we can't just delete timeouts in the above loop, because the JS
-  # timeout handler may clear them in an arbitrary order
-  H = state.timeouts.high
-  for i in countdown(H, 0):
-    if state.timeouts[i].dead:
-      state.clearTimeout0(i)
-  return found
+      state.free(entry)
+    else:
+      case entry.t
+      of ttTimeout:
+        state.map.del(entry.id)
+        state.free(entry)
+      of ttInterval:
+        entry.expires = now + entry.timeout
+        state.push(entry)
+  return due.len > 0
 
 proc clearAll*(state: var TimeoutState) =
-  let rt = state.jsrt
-  for entry in state.timeouts:
-    JS_FreeValueRT(rt, entry.val)
-    rt.freeValues(entry.args)
-  state.timeouts.setLen(0)
+  for entry in state.map.values:
+    entry.dead = true
+    if entry.index != -1:
+      state.free(entry)
+    # else it is being run; run frees it afterwards
+  state.heap.setLen(0)
+  state.map.clear()
 
 {.pop.} # raises: []
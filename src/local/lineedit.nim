@@ -159,12 +159,12 @@ proc generateOutput*(edit: LineEdit; hlcolor: CellColor): FixedGrid =
   result = newFixedGrid(edit.promptw + edit.maxwidth + 1, 1)
   var x = 0
   for u in edit.prompt.points:
-    result[x].str.addUTF8(u)
+    result.addText(x, u.toUTF8())
     x += u.width()
     if x >= result.width: break
   for i in 0 ..< edit.padding:
     if x < result.width:
-      result[x].str = " "
+      result.setText(x, ' ')
       inc x
   var i = edit.shifti
   let selectStart = edit.selectStart
@@ -183,12 +183,11 @@ proc generateOutput*(edit: LineEdit; hlcolor: CellColor): FixedGrid =
       break
     if not edit.hide:
       if u.isControlChar():
-        result[x].str = u.controlToVisual()
+        result.setText(x, u.controlToVisual())
       else:
-        for j in pi ..< i:
-          result[x].str &= edit.text[j]
+        result.addText(x, edit.text.toOpenArray(pi, i - 1))
     else:
-      result[x].str &= '*'
+      result.addText(x, "*")
     result[x].format = format
     x += w
 
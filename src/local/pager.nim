@@ -736,24 +736,23 @@ proc writeStatusMessage(status: var Surface; str: string; format = Format();
     if u.isControlChar():
       if u == uint32('\t'):
         while w > 0:
-          status.grid[x].str = " "
+          status.grid.setText(x, ' ')
           status.grid[x].format = format
           inc x
           dec w
         continue
-      status.grid[x].str = u.controlToVisual()
+      status.grid.setText(x, u.controlToVisual())
     else:
-      status.grid[x].str = u.toUTF8()
+      status.grid.setText(x, u.toUTF8())
     status.grid[x].format = format
     let nx = x + w
     inc x
     while x < nx: # clear unset cells
-      status.grid[x].str = ""
-      status.grid[x].format = Format()
+      status.grid.clear(x)
       inc x
   result = x
   while x < e:
-    status.grid[x] = FixedCell()
+    status.grid.clear(x)
     inc x
 
 # Note: should only be called directly after user interaction.
@@ -790,6 +789,10 @@ proc refreshStatusMsg(pager: Pager) =
         " (" & $iface.atPercentOf() & "%)"
     else:
       msg &= "Viewing"
+    if iface != nil:
+      let matches = iface.matchStatus()
+      if matches != "":
+        msg &= " [" & matches & ']'
     if bifCrashed in init.flags:
       msg &= " CRASHED!"
     msg &= " <" & init.title
@@ -924,19 +927,52 @@ type CachedImageEnv {.final.} = ref object of RootObj
   cachedImage: CachedImage
   iface: BufferInterface
   cacheId: int
+  preview: bool # set if this env loads a preview of cachedImage
+  frame: int # animation frame loaded by this env; -1 for still images
+  decodedId: int # animated images: cache id of all decoded frames
+
+# Minimum number of pixels in the source image for display.image-preview to
+# kick in.  Previews of smaller images are not worth the extra requests.
+const ImagePreviewMinArea = 256 * 256
+const ImagePreviewSize = 8
+
+# Animation budget: we only animate images whose frames take up less than
+# this much memory, both before and after resizing; anything else is shown
+# as a still image.
+const MaxAnimationFrames = 256
+const MaxAnimationBytes = 64 * 1024 * 1024
+
+# Returns true if the image has been canceled, or if this is a preview and
+# the full image has already been loaded.
+proc superseded(env: CachedImageEnv): bool =
+  let state = env.cachedImage.state
+  return state == cisCanceled or env.preview and state == cisLoaded
+
+proc loadAnimationFrame(env: CachedImageEnv; frame: int)
+
+# Called when a frame of an animated image has been loaded (or failed to
+# load).  We load frames one at a time, so this starts loading the next
+# frame, or if there is none, cleans up the decoded data.
+proc frameDone(env: CachedImageEnv) =
+  if env.frame < 0:
+    return
+  let cachedImage = env.cachedImage
+  let next = env.frame + 1
+  if cachedImage.state != cisCanceled and next < cachedImage.frames.len:
+    env.loadAnimationFrame(next)
+  else:
+    env.pager.loader.removeCachedItem(env.decodedId)
 
-proc loadCachedImage3(opaque: RootRef; response: Response) =
-  let env = CachedImageEnv(opaque)
+proc loadCachedImageData0(env: CachedImageEnv; response: Response;
+    ctype: string) =
   let pager = env.pager
   let cachedImage = env.cachedImage
   let loader = pager.loader
-  # remove previous step
-  loader.removeCachedItem(env.cacheId)
   if response == nil:
     return
   loader.close(response)
   let cacheId = response.outputId
-  if cachedImage.state == cisCanceled:
+  if env.superseded():
     loader.removeCachedItem(cacheId)
     return
   let ps = loader.openCachedItem(cacheId)
@@ -946,32 +982,66 @@ proc loadCachedImage3(opaque: RootRef; response: Response) =
   let mem = ps.mmap()
   ps.sclose()
   if mem == nil:
-    loader.removeCachedItem(env.cacheId)
+    loader.removeCachedItem(cacheId)
     return
-  let blob = newBlob(mem.p, mem.len, "image/x-sixel",
+  let blob = newBlob(mem.p, mem.len, ctype,
     (proc(opaque, p: pointer) =
       deallocMem(cast[MaybeMappedMemory](opaque))
     ), mem
   )
+  let transparent =
+    response.headers.getFirst("Cha-Image-Sixel-Transparent") == "1"
+  let plens = response.headers.getFirst("Cha-Image-Sixel-Prelude-Len")
+  let preludeLen = parseIntP(plens).get(0)
+  if env.frame >= 0:
+    let frame = addr cachedImage.frames[env.frame]
+    frame.data = blob
+    frame.cacheId = cacheId
+    frame.transparent = transparent
+    frame.preludeLen = preludeLen
+    if env.frame == 0: # display the first frame as soon as possible
+      cachedImage.setFrame(0)
+      cachedImage.state = cisLoaded
+      env.iface.queueDraw()
+    return
   env.iface.queueDraw()
+  if cachedImage.state == cisPreview:
+    # drop the preview; CanvasImages still displaying it hold a reference
+    # to the blob, so the mapping stays alive until they are replaced.
+    loader.removeCachedItem(cachedImage.cacheId)
   cachedImage.data = blob
-  cachedImage.state = cisLoaded
+  cachedImage.state = if env.preview: cisPreview else: cisLoaded
   cachedImage.cacheId = cacheId
-  cachedImage.transparent =
-    response.headers.getFirst("Cha-Image-Sixel-Transparent") == "1"
-  let plens = response.headers.getFirst("Cha-Image-Sixel-Prelude-Len")
-  cachedImage.preludeLen = parseIntP(plens).get(0)
+  cachedImage.transparent = transparent
+  cachedImage.preludeLen = preludeLen
+
+proc loadCachedImageData(env: CachedImageEnv; response: Response;
+    ctype: string) =
+  env.loadCachedImageData0(response, ctype)
+  env.frameDone()
+
+proc loadCachedImage3(opaque: RootRef; response: Response) =
+  let env = CachedImageEnv(opaque)
+  # remove previous step
+  env.pager.loader.removeCachedItem(env.cacheId)
+  let ctype = if env.pager.term.imageMode == imKitty:
+    "image/png"
+  else:
+    "image/x-sixel"
+  env.loadCachedImageData(response, ctype)
 
 proc loadCachedImage2(env: CachedImageEnv; response: Response) =
   let pager = env.pager
   let cachedImage = env.cachedImage
   if response == nil:
+    env.frameDone()
     return
   let cacheId = response.outputId
   env.cacheId = cacheId
   let loader = pager.loader
-  if cachedImage.state == cisCanceled:
+  if env.superseded():
     loader.removeCachedItem(cacheId)
+    env.frameDone()
     return
   let headers = newHeaders(hgRequest, {
     "Cha-Image-Dimensions": $cachedImage.width & 'x' & $cachedImage.height
@@ -985,6 +1055,11 @@ proc loadCachedImage2(env: CachedImageEnv; response: Response) =
     headers.add("Cha-Image-Offset", $cachedImage.offx & 'x' & $cachedImage.erry)
     headers.add("Cha-Image-Crop-Width", $cachedImage.dispw)
   of imKitty:
+    if pager.term.kittyTempFiles:
+      # The terminal reads the image from a file, so compressing it would
+      # be a waste of time; just send the RGBA data.
+      env.loadCachedImageData(response, "image/x-cha-rgba")
+      return
     url = parseURL0("img-codec+png:encode")
   of imNone: assert false
   let request = newRequest(
@@ -1003,6 +1078,71 @@ proc loadCachedImageResize(opaque: RootRef; response: Response) =
   env.pager.loader.removeCachedItem(env.cacheId)
   env.loadCachedImage2(response)
 
+proc loadCachedImagePreview(opaque: RootRef; response: Response) =
+  # the decoded image is shared with the main pipeline, which removes it
+  # once the real resize is done.
+  CachedImageEnv(opaque).loadCachedImage2(response)
+
+proc loadImagePreview(env: CachedImageEnv; cacheId: int) =
+  let pager = env.pager
+  let cachedImage = env.cachedImage
+  let bmp = cachedImage.bmp
+  let headers = newHeaders(hgRequest, {
+    "Cha-Image-Dimensions": $bmp.width & 'x' & $bmp.height,
+    "Cha-Image-Target-Dimensions": $cachedImage.width & 'x' &
+      $cachedImage.height,
+    "Cha-Image-Preview-Dimensions": $ImagePreviewSize & 'x' &
+      $ImagePreviewSize
+  })
+  let request = newRequest(
+    "cgi-bin:resize",
+    httpMethod = hmPost,
+    headers = headers,
+    body = RequestBody(t: rbtCache, cacheId: cacheId),
+    tocache = true
+  )
+  let penv = CachedImageEnv(
+    pager: pager,
+    cachedImage: cachedImage,
+    iface: env.iface,
+    preview: true,
+    frame: -1
+  )
+  pager.loader.fetch(request, loadCachedImagePreview, penv)
+
+proc loadCachedImageFrame(opaque: RootRef; response: Response) =
+  # unlike loadCachedImageResize, we keep the decoded data around for the
+  # next frame; frameDone removes it after the last one.
+  CachedImageEnv(opaque).loadCachedImage2(response)
+
+proc loadAnimationFrame(env: CachedImageEnv; frame: int) =
+  let pager = env.pager
+  let cachedImage = env.cachedImage
+  let bmp = cachedImage.bmp
+  # resize also extracts the frame, so we need it even if the image size
+  # does not change.
+  let headers = newHeaders(hgRequest, {
+    "Cha-Image-Dimensions": $bmp.width & 'x' & $bmp.height,
+    "Cha-Image-Target-Dimensions": $cachedImage.width & 'x' &
+      $cachedImage.height,
+    "Cha-Image-Frame": $frame
+  })
+  let request = newRequest(
+    "cgi-bin:resize",
+    httpMethod = hmPost,
+    headers = headers,
+    body = RequestBody(t: rbtCache, cacheId: env.decodedId),
+    tocache = true
+  )
+  let fenv = CachedImageEnv(
+    pager: pager,
+    cachedImage: cachedImage,
+    iface: env.iface,
+    frame: frame,
+    decodedId: env.decodedId
+  )
+  pager.loader.fetch(request, loadCachedImageFrame, fenv)
+
 proc loadCachedImage0(opaque: RootRef; response: Response) =
   let env = CachedImageEnv(opaque)
   let pager = env.pager
@@ -1016,10 +1156,34 @@ proc loadCachedImage0(opaque: RootRef; response: Response) =
   if cachedImage.state == cisCanceled: # container is no longer visible
     pager.loader.removeCachedItem(cacheId)
     return
+  let frameCount =
+    parseIntP(response.headers.getFirst("Cha-Image-Frame-Count")).get(1)
+  if frameCount > 1:
+    cachedImage.frames = newSeq[CachedImageFrame](frameCount)
+    cachedImage.frameExpires = -1
+    var i = 0
+    for s in response.headers.getFirst("Cha-Image-Frame-Delays").split(','):
+      if i >= frameCount:
+        break
+      let delay = parseIntP(s).get(0)
+      # like other browsers, we treat tiny delays as unspecified.
+      cachedImage.frames[i].delay = if delay <= 10: 100 else: delay
+      inc i
+    for it in cachedImage.frames.toOpenArray(i, frameCount - 1).mitems:
+      it.delay = 100
+    env.decodedId = cacheId
+    env.loadAnimationFrame(0)
+    pager.loader.close(response)
+    return
   if cachedImage.width == bmp.width and cachedImage.height == bmp.height:
     # skip resize
     env.loadCachedImage2(response)
     return
+  if pager.config{"imagePreview"} and
+      bmp.width * bmp.height >= ImagePreviewMinArea:
+    # Note: this must be sent before the real resize, so that the loader
+    # reads the decoded image before it is removed.
+    env.loadImagePreview(cacheId)
   # resize
   # use a temp file, so that img-resize can mmap its output
   let headers = newHeaders(hgRequest, {
@@ -1052,16 +1216,26 @@ proc loadCachedImage(pager: Pager; iface: BufferInterface; bmp: NetworkBitmap;
       iface.process):
     pager.alert("Error: received incorrect cache ID from buffer")
     return
+  # let the decoder know how many frames we are willing to animate
+  let frameBytes = max(bmp.width * bmp.height, width * height) * 4
+  let maxFrames = min(MaxAnimationBytes div max(frameBytes, 1),
+    MaxAnimationFrames)
+  let headers = newHeaders(hgRequest)
+  if maxFrames > 1:
+    headers.add("Cha-Image-Max-Frames", $maxFrames)
+    headers.add("Cha-Image-Max-Bytes", $MaxAnimationBytes)
   let request = newRequest(
     "img-codec+" & bmp.contentType.after('/') & ":decode",
     httpMethod = hmPost,
+    headers = headers,
     body = RequestBody(t: rbtCache, cacheId: bmp.cacheId),
     tocache = true
   )
   let opaque = CachedImageEnv(
     pager: pager,
     cachedImage: cachedImage,
-    iface: iface
+    iface: iface,
+    frame: -1
   )
   pager.loader.fetch(request, loadCachedImage0, opaque)
   iface.addCachedImage(cachedImage)
@@ -1081,24 +1255,31 @@ proc initImages(pager: Pager; iface: BufferInterface) =
     if not dims.onScreen:
       continue
     let imageId = image.bmp.imageId
-    let canvasImage = term.takeImage(pid, imageId, bufHeight, dims)
-    if canvasImage != nil:
-      term.addImage(canvasImage)
-      continue
     let cachedOffx = if imageMode == imSixel: dims.offx else: 0
     let cachedErry = if imageMode == imSixel: dims.erry else: 0
     let cachedDispw = if imageMode == imSixel: dims.dispw else: 0
     let width = image.width
     let height = image.height
+    let canvasImage = term.takeImage(pid, imageId, bufHeight, dims)
+    if canvasImage != nil:
+      let cached = iface.findCachedImage(imageId, width, height, cachedOffx,
+        cachedErry, cachedDispw)
+      if cached != nil and cached.state == cisLoaded and
+          (canvasImage.preview or canvasImage.frame != cached.frame):
+        term.replaceImage(canvasImage, cached.data, cached.preludeLen,
+          cached.transparent, cached.frame, bufHeight)
+      term.addImage(canvasImage)
+      continue
     let cached = iface.findCachedImage(imageId, width, height, cachedOffx,
       cachedErry, cachedDispw)
     if cached == nil:
       pager.loadCachedImage(iface, image.bmp, width, height, cachedOffx,
         cachedErry, cachedDispw)
       continue
-    if cached.state == cisLoaded:
+    if cached.state in {cisPreview, cisLoaded}:
       let canvasImage = newCanvasImage(cached.data, pid, cached.preludeLen,
-        image.bmp, dims, cached.transparent)
+        image.bmp, dims, cached.transparent, cached.state == cisPreview)
+      canvasImage.frame = cached.frame
       term.addImage(canvasImage)
   # updateImages yields all scrolled Sixel images damaged by checkImageDamage
   # with a new Y error.  For these, we have to reload the cached image.
@@ -1114,10 +1295,45 @@ proc initImages(pager: Pager; iface: BufferInterface) =
       pager.loadCachedImage(iface, canvasImage.bmp, width, height,
         cachedOffx, cachedErry, cachedDispw)
       canvasImage.damaged = false
-    elif cached.state != cisLoaded:
+    elif cached.state notin {cisPreview, cisLoaded}:
       canvasImage.damaged = false
     else:
-      canvasImage.updateImage(cached.data, cached.preludeLen)
+      canvasImage.updateImage(cached.data, cached.preludeLen,
+        cached.state == cisPreview)
+      canvasImage.frame = cached.frame
+
+# Advance animated images of the current buffer whose frame has expired.
+# Images that are not on the screen are paused, so that we do not keep
+# waking up for them.
+# Returns the number of milliseconds until the next frame change, or -1 if
+# nothing is playing.
+proc updateAnimations(pager: Pager): cint =
+  let iface = pager.bufferIface
+  if iface == nil or pager.term.imageMode == imNone:
+    return -1
+  let now = getUnixMillis()
+  var next = -1i64
+  for image in iface.cachedImages:
+    if image.frames.len == 0 or image.state != cisLoaded:
+      continue
+    if not pager.term.isImageShown(iface.process, image.bmp.imageId):
+      image.frameExpires = -1
+      continue
+    if image.frameExpires < 0:
+      image.frameExpires = now + image.frames[image.frame].delay
+    elif image.frameExpires <= now:
+      let i = (image.frame + 1) mod image.frames.len
+      # frames are loaded in order, so if this one isn't ready yet, we
+      # keep showing the current one until it is.
+      if image.frames[i].data != nil:
+        image.setFrame(i)
+        iface.queueDraw()
+      image.frameExpires = now + image.frames[image.frame].delay
+    if next < 0 or image.frameExpires < next:
+      next = image.frameExpires
+  if next < 0:
+    return -1
+  return cint(max(next - now, 0))
 
 proc getAbsoluteCursorXY(pager: Pager; iface: BufferInterface): PagePos =
   var cursorx = 0
@@ -1539,7 +1755,10 @@ proc applySiteconf(pager: Pager; url: URL; charsetOverride: Charset;
     headless: pager.config{"headless"},
     charsetOverride: charsetOverride,
     metaRefresh: pager.config{"metaRefresh"},
-    markLinks: pager.config{"markLinks"}
+    markLinks: pager.config{"markLinks"},
+    jsMemoryLimit: pager.config{"jsMemoryLimit"},
+    jsGcThreshold: pager.config{"jsGcThreshold"},
+    scriptCache: pager.config{"scriptCache"}
   )
   loaderConfig = LoaderClientConfig(
     originURL: url,
@@ -1548,7 +1767,8 @@ proc applySiteconf(pager: Pager; url: URL; charsetOverride: Charset;
     proxy: pager.config{"proxy"},
     allowSchemes: @["data", "cache", "stream"],
     cookieMode: pager.config{"cookie"},
-    insecureSslNoVerify: false
+    insecureSslNoVerify: false,
+    persistentStorage: pager.config{"persistentStorage"}
   )
   let allowHttpFromFile = when NimMajor < 2:
     pager.config.bits[coAllowHttpFromFile].bool
@@ -1603,6 +1823,12 @@ proc applySiteconf(pager: Pager; url: URL; charsetOverride: Charset;
         of coMetaRefresh: result.metaRefresh = bit.metaRefresh
         of coHistory: result.history = bit.bool
         of coMarkLinks: result.markLinks = bit.bool
+        of coPersistentStorage: loaderConfig.persistentStorage = bit.bool
+        else: assert false
+      of cocHWord:
+        case e.opt
+        of coJsMemoryLimit: result.jsMemoryLimit = e.hword.int32
+        of coJsGcThreshold: result.jsGcThreshold = e.hword.int32
         else: assert false
       of cocStr:
         case e.opt
@@ -2706,8 +2932,11 @@ proc inputLoop(ctx: JSContext; pager: Pager): Opt[void] {.jsfunc.} =
   pager.loader.pollData.register(pager.term.istream.fd, POLLIN)
   let signals = pager.setupSignals()
   pager.loader.pollData.register(signals.fd, POLLIN)
+  var animationTimeout = cint(-1)
   while true:
-    let timeout = pager.timeouts.sortAndGetTimeout()
+    var timeout = pager.timeouts.getTimeout()
+    if animationTimeout >= 0 and (timeout < 0 or animationTimeout < timeout):
+      timeout = animationTimeout
     pager.loader.pollData.poll(timeout)
     pager.loader.blockRegister()
     for event in pager.loader.pollData.events:
@@ -2763,6 +2992,7 @@ proc inputLoop(ctx: JSContext; pager: Pager): Opt[void] {.jsfunc.} =
     of ussNone, ussSkip: discard
     of ussUpdate: pager.refreshStatusMsg()
     pager.updateStatus = ussNone
+    animationTimeout = pager.updateAnimations()
     if not pager.draw():
       return ok()
   ok()
@@ -2774,7 +3004,7 @@ proc hasSelectFds(pager: Pager): bool =
 # private
 proc headlessLoop(ctx: JSContext; pager: Pager): Opt[void] {.jsfunc.} =
   while pager.hasSelectFds():
-    let timeout = pager.timeouts.sortAndGetTimeout()
+    let timeout = pager.timeouts.getTimeout()
     pager.loader.pollData.poll(timeout)
     pager.loader.blockRegister()
     for event in pager.loader.pollData.events:
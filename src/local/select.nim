@@ -288,12 +288,12 @@ proc drawBorders(display: var FixedGrid; sx, ex, sy, ey: int;
     var x = 0
     let yi = y * display.width
     while true:
-      if display[yi + x].str == "":
-        display[yi + x].str = " "
-      let w = display[yi + x].str.width()
+      if display.textLen(yi + x) == 0:
+        display.setText(yi + x, ' ')
+      let w = display.width(yi + x)
       if x + w > sx:
         while x < sx:
-          display[yi + x].str = " "
+          display.setText(yi + x, ' ')
           inc x
         break
       x += w
@@ -303,10 +303,10 @@ proc drawBorders(display: var FixedGrid; sx, ex, sy, ey: int;
   let bl = if downmore: bdcVerticalBarLeft else: bdcCornerBottomLeft
   let br = if downmore: bdcVerticalBarRight else: bdcCornerBottomRight
   const fmt = Format()
-  display[sy * display.width + sx].str = $tl
-  display[sy * display.width + ex].str = $tr
-  display[ey * display.width + sx].str = $bl
-  display[ey * display.width + ex].str = $br
+  display.setText(sy * display.width + sx, $tl)
+  display.setText(sy * display.width + ex, $tr)
+  display.setText(ey * display.width + sx, $bl)
+  display.setText(ey * display.width + ex, $br)
   display[sy * display.width + sx].format = fmt
   display[sy * display.width + ex].format = fmt
   display[ey * display.width + sx].format = fmt
@@ -315,18 +315,18 @@ proc drawBorders(display: var FixedGrid; sx, ex, sy, ey: int;
   let ups = if upmore: " " else: $bdcHorizontalBarTop
   let downs = if downmore: " " else: $bdcHorizontalBarBottom
   for x in sx + 1 .. ex - 1:
-    display[sy * display.width + x].str = ups
-    display[ey * display.width + x].str = downs
+    display.setText(sy * display.width + x, ups)
+    display.setText(ey * display.width + x, downs)
     display[sy * display.width + x].format = fmt
     display[ey * display.width + x].format = fmt
   if upmore:
-    display[sy * display.width + sx + (ex - sx) div 2].str = ":"
+    display.setText(sy * display.width + sx + (ex - sx) div 2, ':')
   if downmore:
-    display[ey * display.width + sx + (ex - sx) div 2].str = ":"
+    display.setText(ey * display.width + sx + (ex - sx) div 2, ':')
   # Draw left, right borders.
   for y in sy + 1 .. ey - 1:
-    display[y * display.width + sx].str = $bdcVerticalBarLeft
-    display[y * display.width + ex].str = $bdcVerticalBarRight
+    display.setText(y * display.width + sx, $bdcVerticalBarLeft)
+    display.setText(y * display.width + ex, $bdcVerticalBarRight)
     display[y * display.width + sx].format = fmt
     display[y * display.width + ex].format = fmt
 
@@ -371,23 +371,21 @@ proc drawSelect*(select: Select; display: var FixedGrid) =
       let nx = x + uw
       if nx > ex:
         break
-      display[dls + x].str = ""
       if u.isControlChar():
-        display[dls + x].str &= u.controlToVisual()
+        display.setText(dls + x, u.controlToVisual())
       else:
-        for l in pj ..< j:
-          display[dls + x].str &= select.options[i].s[l]
+        display.setText(dls + x, select.options[i].s.toOpenArray(pj, j - 1))
       display[dls + x].format = format
       if x == sx:
         # do not reverse the position of the cursor
         display[dls + x].format.excl(ffReverse)
       inc x
       while x < nx:
-        display[dls + x].str = ""
+        display.clearText(dls + x)
         display[dls + x].format = format
         inc x
     while x < ex:
-      display[dls + x].str = " "
+      display.setText(dls + x, ' ')
       display[dls + x].format = format
       inc x
 
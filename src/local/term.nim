@@ -101,6 +101,8 @@ type
     damaged*: bool
     transparent: bool
     scrolled: bool # sixel only: set if screen was scrolled since printing
+    preview*: bool # set if data is a placeholder for the full image
+    frame*: int # animation frame currently displayed
     preludeLen: int
     kittyId: uint
     data: Blob
@@ -111,7 +113,7 @@ type
     n: int # bytes of s already flushed
     next: TerminalPage
 
-  TermdescFlag = enum # 16 bits, 1 free
+  TermdescFlag = enum # 32 bits, 15 free
     tfTitle # can set window title
     tfPreEcma48 # does not support ECMA-48/VT100-like queries (DA1 etc.)
     tfXtermQuery # supports XTerm-like queries (background color etc.)
@@ -128,9 +130,14 @@ type
     tfFlowControl # uses XON/XOFF flow control (usually hardware terminals)
     tfScroll # supports VT100-style scroll (with scroll area)
     tfFastScroll # has SD/SU control sequences
+    tfRep # has REP (repeat preceding character)
 
   Termdesc = set[TermdescFlag]
 
+  KittyMedium = enum
+    kmDirect # base64 encoded data in APC chunks
+    kmTempFile # temp file, which the terminal deletes after reading
+
   FrameType = enum
     ftCurrent # non-discardable
     ftNext # discardable
@@ -139,9 +146,10 @@ type
     head: TerminalPage # output buffer queue
     tail: TerminalPage # last output buffer
     canvasImagesHead: CanvasImage
-    canvas: seq[FixedCell]
+    canvas: FixedGrid
     kittyImagesToClear: seq[uint] # Kitty only; vector of image ids
-    lineDamage: seq[int]
+    lineDamage: seq[int] # first damaged cell of each line
+    cellDamage: seq[bool] # cells that must be repainted
     title: string # current title
     pos: tuple[pid, x, y: int]
     scrollTodo: int # lines to scroll (negative = up, positive = down)
@@ -191,6 +199,9 @@ type
     loader: FileLoader # callback to register ostream
     sixelRegisterNum*: uint16
     kittyId: uint # counter for kitty image (*not* placement) ids.
+    kittyMedium: KittyMedium
+    kittyTmpSeq: int # counter for kitty temp file names
+    kittyProbe: string # temp file sent with KittyQuery; "" if none
     colorMap: array[16, RGBColor]
 
   QueryState = enum
@@ -367,19 +378,19 @@ const TrueColorFlag = {tfColor1, tfColor2}
 const TermdescMap = [
   ttAdm3a: {tfMargin, tfPreEcma48},
   ttAlacritty: XtermCompatible + TrueColorFlag,
-  ttContour: XtermCompatible,
+  ttContour: XtermCompatible + {tfRep},
   ttDvtm: {tfAltScreen, tfBleedsAPC, tfBracketedPaste} + AnsiColorFlag,
   ttEat: XtermCompatible + TrueColorFlag,
   # eterm bleeds titles.
   ttEterm: {tfXtermQuery, tfBracketedPaste, tfScroll} + AnsiColorFlag,
   ttFbterm: {tfXtermQuery, tfBracketedPaste} + AnsiColorFlag,
-  ttFoot: XtermCompatible,
+  ttFoot: XtermCompatible + {tfRep},
   # FreeBSD has code to respond to queries, but it's #if 0'd out :(
   # It has no bracketed paste (duh).
   ttFreebsd: {tfPreEcma48, tfScroll} + AnsiColorFlag,
-  ttGhostty: XtermCompatible,
+  ttGhostty: XtermCompatible + {tfRep},
   ttIterm2: XtermCompatible,
-  ttKitty: XtermCompatible + TrueColorFlag + {tfPrimary},
+  ttKitty: XtermCompatible + TrueColorFlag + {tfPrimary, tfRep},
   ttKonsole: XtermCompatible,
   # Linux accepts true color or eight bit sequences, but as per the
   # man page they are "shoehorned into 16 colors".  This breaks color
@@ -387,7 +398,7 @@ const TermdescMap = [
   # It also fails to advertise ANSI color in DA1, so we set it here.
   # Linux has no alt screen, and no paste (let alone bracketed).
   ttLinux: {tfXtermQuery, tfScroll} + AnsiColorFlag,
-  ttMintty: XtermCompatible + TrueColorFlag,
+  ttMintty: XtermCompatible + TrueColorFlag + {tfRep},
   ttMlterm: XtermCompatible + TrueColorFlag,
   ttMsTerminal: XtermCompatible + TrueColorFlag,
   ttPutty: XtermCompatible + TrueColorFlag,
@@ -414,10 +425,12 @@ const TermdescMap = [
   ttVt100Nav: Vt100Compatible,
   ttVt420: Vt100Compatible + {tfFastScroll},
   ttVt52: {tfPreEcma48, tfFlowControl},
-  ttVte: XtermCompatible + TrueColorFlag,
-  ttWezterm: XtermCompatible,
+  ttVte: XtermCompatible + TrueColorFlag + {tfRep},
+  ttWezterm: XtermCompatible + {tfRep},
   ttWterm: XtermCompatible + TrueColorFlag,
   ttXst: XtermCompatible + TrueColorFlag,
+  # XTerm has REP, but it is also our fallback for unknown terminals, so we
+  # do not use it.
   ttXterm: XtermCompatible,
   # yaft supports Sixel, but can't tell us so in DA1.
   ttYaft: XtermCompatible + {tfSixel, tfBleedsAPC} -
@@ -504,6 +517,9 @@ const APC = "\e_"
 
 const KittyQuery = APC & "Gi=1,s=1,v=1,a=q;AAAAAA" & ST
 
+# query with temp file medium; see queryKittyTempFile
+const KittyTempFileQueryStart = APC & "Gi=2,s=1,v=1,a=q,t=t,f=32;"
+
 iterator canvasImages(frame: Frame): CanvasImage =
   var image = frame.canvasImagesHead
   while image != nil:
@@ -548,6 +564,7 @@ proc swapFrame(term: Terminal; frameType: FrameType) =
     term.frame.tail = move(term.frames[ftNext].tail)
     swap(term.frame.canvas, term.frames[ot].canvas)
     swap(term.frame.lineDamage, term.frames[ot].lineDamage)
+    swap(term.frame.cellDamage, term.frames[ot].cellDamage)
     swap(term.frame.kittyImagesToClear, term.frames[ot].kittyImagesToClear)
     # could swap this too, but that would keep data alive for longer than
     # desirable
@@ -559,9 +576,9 @@ proc swapFrame(term: Terminal; frameType: FrameType) =
     # is dropped).
     term.frame.head = nil
     term.frame.tail = nil
-    for i in 0 ..< term.frames[ot].canvas.len:
-      term.frame.canvas[i] = term.frames[ot].canvas[i]
+    term.frame.canvas = term.frames[ot].canvas
     chaArrayCopy(term.frame.lineDamage, term.frames[ot].lineDamage)
+    chaArrayCopy(term.frame.cellDamage, term.frames[ot].cellDamage)
     #TODO we could avoid some allocations here by reusing CanvasImage
     # objects from the frame to be dropped
     var imagesHead: CanvasImage = nil
@@ -909,7 +926,8 @@ proc parseEsc(eparser: var EventParser; c: char) =
   of '[': eparser.state = esCSI
   of ']': eparser.state = esOSC
   of 'P': eparser.nextState(qsTcapRGB, c, esDCS)
-  of '_': eparser.nextState(qsKitty, c, esAPC)
+  # we may get two responses (one for each kitty query)
+  of '_': eparser.nextStateSameQuery(qsKitty, c, esAPC)
   else: eparser.backtrack(c)
 
 proc parseCSI(eparser: var EventParser; c: char) =
@@ -1177,10 +1195,24 @@ proc parseDCS1PlusR(term: Terminal; c: char): EscParseChunkResult =
   eprNone
 
 proc parseAPCG(term: Terminal; c: char): EscParseChunkResult =
+  if not term.eparser.parseST(c):
+    if term.eparser.buf.len < 256: # only need the start, really
+      term.eparser.buf &= c
+    return eprNone
+  let s = move(term.eparser.buf)
+  if s.startsWith("i=2;"): # temp file query
+    let probe = move(term.kittyProbe)
+    if probe != "":
+      # Only use temp files if the terminal has also deleted the probe;
+      # otherwise, they would pile up in our tmpdir.
+      if s == "i=2;OK" and access(cstring(probe), F_OK) != 0:
+        term.kittyMedium = kmTempFile
+      else:
+        discard unlink(cstring(probe))
+    return eprNone
   let imageMode = term.imageMode
   if term.config{"imageMode"}.isNone:
     term.imageMode = imKitty
-  term.eparser.skipToST(c)
   if imageMode != term.imageMode:
     return eprRedraw
   eprNone
@@ -1280,6 +1312,14 @@ proc cursorGoto(term: Terminal; x, y: uint32): Opt[void] =
   if term.frame.cursorKnown and term.frame.cursorx == x and
       term.frame.cursory == y:
     return ok()
+  if term.frame.cursorKnown and y == term.frame.cursory and
+      x > term.frame.cursorx and term.termType notin {ttAdm3a, ttVt52}:
+    # Same line, to the right: CSI n C is shorter than CSI y;x H.
+    let n = x - term.frame.cursorx
+    term.frame.cursorx = x
+    if n == 1:
+      return term.write(CSI & 'C')
+    return term.write(CSI & $n & 'C')
   if term.frame.cursorKnown and (x == 0 or x == term.frame.cursorx) and
       y - term.frame.cursory <= 6:
     # This is probably more efficient than setting the cursor by address.
@@ -1697,24 +1737,166 @@ proc moveLinesUp(term: Terminal; n: int): Opt[void] =
 proc moveLinesDown(term: Terminal; n: int): Opt[void] =
   term.write(CSI & $n & 'T')
 
-proc processCell(term: Terminal; cell: FixedCell; x: int): Opt[void] =
-  if cell.str.len == 0:
+# Output cost model.
+#
+# Over slow links (e.g. SSH), the number of bytes we write is what the user
+# waits for, so when repainting a line we pick the cheapest way to get each
+# damaged cell onto the screen:
+# * clean cells between two damaged ones are skipped with a cursor movement,
+#   unless repainting them takes fewer bytes;
+# * runs of the same character are compressed with REP;
+# * blank cells at the end of the line are erased with EL.
+#
+# Costs are in bytes; SGR changes are estimated, since we only know their
+# exact length after color reduction.
+const SGRCostEstimate = 8
+
+proc numCost(n: int): int =
+  var n = n
+  result = 1
+  while n >= 10:
+    n = n div 10
+    inc result
+
+# CSI n C, or an absolute movement on terminals without it
+proc cursorForwardCost(term: Terminal; n: int): int =
+  if term.termType in {ttAdm3a, ttVt52}:
+    return 4
+  if n == 1:
+    return 3 # CSI C
+  return 3 + numCost(n)
+
+# CSI n b
+proc repCost(n: int): int =
+  return 3 + numCost(n)
+
+# Bytes needed to repaint cells sx ..< ex of line y as they are.
+proc repaintCost(term: Terminal; y, sx, ex: int): int =
+  let si = y * term.attrs.width
+  var format = term.frame.format
+  result = 0
+  for i in si + sx ..< si + ex:
+    let len = term.frame.canvas.textLen(i)
+    if len == 0:
+      continue
+    if term.frame.canvas[i].format != format:
+      result += SGRCostEstimate
+      format = term.frame.canvas[i].format
+    result += len
+
+# Mark cells sx ..< ex of line y as damaged.
+proc damage(term: Terminal; y, sx, ex: int) =
+  let si = y * term.attrs.width
+  for i in si + sx ..< si + ex:
+    term.frame.cellDamage[i] = true
+  term.frame.lineDamage[y] = min(term.frame.lineDamage[y], sx)
+
+# Cells that look the same after erasing them with EL.
+proc isBlank(grid: FixedGrid; i: int): bool =
+  return grid.textLen(i) == 0 or
+    grid.textIs(i, " ") and grid[i].format == Format()
+
+proc cursorForward(term: Terminal; x, y: int): Opt[void] =
+  let n = x - int(term.frame.cursorx)
+  if n <= 0:
     return ok()
-  # if previous cell was empty, catch up with x
-  let x = uint32(x)
-  while term.frame.cursorx < x:
+  case term.termType
+  of ttAdm3a, ttVt52: return term.cursorGoto(x, y)
+  else:
+    term.frame.cursorx = uint32(x)
+    if n == 1:
+      return term.write(CSI & 'C')
+    return term.write(CSI & $n & 'C')
+
+# Write n spaces, e.g. to skip over empty cells that must be painted.
+proc writeSpaces(term: Terminal; n: int): Opt[void] =
+  if n <= 0:
+    return ok()
+  term.frame.cursorx += uint32(n)
+  if tfRep in term.desc and repCost(n - 1) < n - 1:
+    ?term.write(' ')
+    return term.write(CSI & $(n - 1) & 'b')
+  for i in 0 ..< n:
     ?term.write(' ')
-    inc term.frame.cursorx
-  ?term.processFormat(cell.format)
-  term.processOutputString(cell.str)
-
-proc drawLine(term: Terminal; sx, y: int): Opt[void] =
-  for x in sx ..< term.attrs.width:
-    ?term.processCell(term.frame.canvas[y * term.attrs.width + x], x)
-  if term.frame.cursorx < uint32(term.attrs.width):
+  ok()
+
+proc processCell(term: Terminal; i, x: int): Opt[void] =
+  if term.frame.canvas.textLen(i) == 0:
+    return ok()
+  # if previous cell was empty, catch up with x
+  ?term.writeSpaces(x - int(term.frame.cursorx))
+  ?term.processFormat(term.frame.canvas[i].format)
+  term.processOutputString(term.frame.canvas.text(i))
+
+# Paint the damaged cells of line y, starting from sx.  If full is set,
+# paint every cell instead.
+proc drawLine(term: Terminal; sx, y: int; full = false): Opt[void] =
+  let w = term.attrs.width
+  let si = y * w
+  # ex is the start of the blank tail, which is cleared with EL if any of it
+  # is damaged.
+  var ex = w
+  while ex > sx and term.frame.canvas.isBlank(si + ex - 1):
+    dec ex
+  var clearTail = full
+  for damaged in term.frame.cellDamage.toOpenArray(si + ex, si + w - 1):
+    clearTail = clearTail or damaged
+  var x = sx
+  while x < ex:
+    if not full and not term.frame.cellDamage[si + x]:
+      # The terminal already shows this cell; skip to the next damaged one,
+      # unless repainting the cells in between is cheaper.
+      var nx = x + 1
+      while nx < ex and not term.frame.cellDamage[si + nx]:
+        inc nx
+      if nx == ex and not clearTail:
+        break
+      let cx = int(term.frame.cursorx)
+      if cx >= nx:
+        x = nx
+        continue
+      if term.repaintCost(y, cx, nx) > term.cursorForwardCost(nx - cx):
+        ?term.cursorForward(nx, y)
+        x = nx
+        continue
+      for i in x ..< nx:
+        ?term.processCell(si + i, i)
+      x = nx
+      continue
+    let ci = si + x
+    if term.frame.canvas.textLen(ci) == 0:
+      # Nothing to print, but the terminal still shows the old contents, so
+      # overwrite them with a space.  (If the cursor is already past x, then
+      # the cell is the second half of a double-width char we just printed.)
+      if int(term.frame.cursorx) <= x:
+        ?term.writeSpaces(x - int(term.frame.cursorx))
+        ?term.processFormat(term.frame.canvas[ci].format)
+        ?term.writeSpaces(1)
+      inc x
+      continue
+    ?term.processCell(ci, x)
+    inc x
+    if tfRep in term.desc and term.frame.canvas.textLen(ci) == 1 and
+        term.frame.canvas.text(ci)[0] in {' '..'~'}:
+      # compress runs of the same character
+      let format = term.frame.canvas[ci].format
+      var nx = x
+      while nx < ex and
+          term.frame.canvas.sameText(si + nx, term.frame.canvas, ci) and
+          term.frame.canvas[si + nx].format == format:
+        inc nx
+      let n = nx - x
+      if n > 0 and repCost(n) < n:
+        ?term.write(CSI & $n & 'b')
+        term.frame.cursorx += uint32(n)
+        x = nx
+  if clearTail and term.frame.cursorx < uint32(w):
+    ?term.cursorForward(ex, y)
     ?term.processFormat(Format())
     ?term.clearEnd()
-  term.frame.lineDamage[y] = term.attrs.width
+  for i in si ..< si + w:
+    term.frame.cellDamage[i] = false
+  term.frame.lineDamage[y] = w
   ok()
 
 proc fullDraw(term: Terminal): Opt[void] =
@@ -1726,7 +1908,7 @@ proc fullDraw(term: Terminal): Opt[void] =
   for y in 0 ..< term.attrs.height:
     if y != 0:
       ?term.cursorNextLineBegin()
-    ?term.drawLine(0, y)
+    ?term.drawLine(0, y, full = true)
   ok()
 
 proc partialDrawScroll(term: Terminal; scroll, scrollBottom: int;
@@ -1784,17 +1966,17 @@ proc writeGrid*(term: Terminal; grid: FixedGrid; x = 0, y = 0) =
     var lastx = 0
     for lx in x ..< x + grid.width:
       let i = ly * term.attrs.width + lx
-      let cell = grid[(ly - y) * grid.width + (lx - x)]
-      if term.frame.canvas[i].str != "":
+      let gi = (ly - y) * grid.width + (lx - x)
+      if term.frame.canvas.textLen(i) > 0:
         # if there is a change, we have to start from the last x with
         # a string (otherwise we might overwrite half of a double-width char)
         lastx = lx
-      let format = term.reduceFormat(cell.format)
+      let format = term.reduceFormat(grid[gi].format)
       if format != term.frame.canvas[i].format or
-          cell.str != term.frame.canvas[i].str:
-        term.frame.canvas[i].str = cell.str
+          not grid.sameText(gi, term.frame.canvas, i):
+        term.frame.canvas.setText(i, grid.text(gi))
         term.frame.canvas[i].format = format
-        term.frame.lineDamage[ly] = min(term.frame.lineDamage[ly], lastx)
+        term.damage(ly, lastx, lx + 1)
 
 proc getCurrentBgcolor*(term: Terminal): CellColor =
   term.frame.format.bgcolor
@@ -1972,7 +2154,7 @@ proc clearImage(term: Terminal; image: CanvasImage; maxh: int) =
     let ey = min(image.dims.y + h, maxh)
     let x = max(image.dims.x, 0)
     for y in max(image.dims.y, 0) ..< ey:
-      term.frame.lineDamage[y] = min(term.frame.lineDamage[y], x)
+      term.damage(y, x, term.attrs.width)
   of imKitty:
     if image.kittyId != 0:
       term.frame.kittyImagesToClear.add(image.kittyId)
@@ -2008,18 +2190,20 @@ proc checkImageDamage(term: Terminal; image: CanvasImage; maxw, maxh: int) =
     # treat it as transparent here.
     # A similar situation arises when od is on the last covered column.
     if image.transparent or eypx < y * ppl or od in mx0 ..< mx:
-      term.frame.lineDamage[y] = x
+      term.damage(y, x, term.attrs.width)
     else:
       var textFound = false
       # damage starts inside an opaque image; skip clear (but only if
       # the damage was not caused by a printing character)
       let si = y * term.attrs.width
       for i in si + od ..< si + term.attrs.width:
-        if term.frame.canvas[i].str.len > 0 and
-            term.frame.canvas[i].str[0] != ' ':
+        if term.frame.canvas.textLen(i) > 0 and
+            term.frame.canvas.text(i)[0] != ' ':
           textFound = true
           break
       if not textFound:
+        for i in si + od ..< si + mx:
+          term.frame.cellDamage[i] = false
         term.frame.lineDamage[y] = mx
 
 proc updateCanvasImage(term: Terminal; image: CanvasImage;
@@ -2089,19 +2273,52 @@ iterator updateImages*(term: Terminal; bufWidth, bufHeight: int): CanvasImage =
       prev = image
       image = image.next
 
-proc updateImage*(image: CanvasImage; data: Blob; preludeLen: int) =
+proc updateImage*(image: CanvasImage; data: Blob; preludeLen: int;
+    preview: bool) =
   image.data = data
   image.preludeLen = preludeLen
+  image.preview = preview
   image.dims.erry2 = image.dims.erry
 
+# Replace the contents of an image already on the screen, e.g. with the full
+# image after a preview, or with the next animation frame.  Unlike removing
+# the image and adding a new one, this leaves the text around the image
+# alone.
+proc replaceImage*(term: Terminal; image: CanvasImage; data: Blob;
+    preludeLen: int; transparent: bool; frame, maxh: int) =
+  case term.imageMode
+  of imNone: discard
+  of imSixel:
+    # the old image would show through the transparent parts of the new
+    # one, so we must repaint whatever is behind it first.
+    if transparent or image.transparent:
+      term.clearImage(image, maxh)
+  of imKitty:
+    # upload the new image with a new id, and delete the old one.
+    term.clearImage(image, maxh)
+    image.kittyId = 0
+  image.data = data
+  image.preludeLen = preludeLen
+  image.transparent = transparent
+  image.preview = false
+  image.frame = frame
+  image.damaged = true
+
+proc isImageShown*(term: Terminal; pid, imageId: int): bool =
+  for image in term.frame.canvasImages:
+    if image.pid == pid and image.bmp.imageId == imageId:
+      return true
+  false
+
 proc newCanvasImage*(data: Blob; pid, preludeLen: int; bmp: NetworkBitmap;
-    dims: CanvasImageDimensions; transparent: bool): CanvasImage =
+    dims: CanvasImageDimensions; transparent, preview: bool): CanvasImage =
   CanvasImage(
     pid: pid,
     bmp: bmp,
     data: data,
     dims: dims,
     transparent: transparent,
+    preview: preview,
     preludeLen: preludeLen,
     damaged: true
   )
@@ -2181,6 +2398,27 @@ proc outputSixelImage(term: Terminal; x, y: int; image: CanvasImage):
     ?term.outputSixelImage(x, y, image, p.toOpenArray(0, H))
   ok()
 
+proc kittyTempPath(term: Terminal): string =
+  # Kitty only deletes temp files with this string in their path.
+  result = term.config{"tmpdir"} / "chaktmp" & $term.loader.clientPid &
+    "-tty-graphics-protocol-" & $term.kittyTmpSeq
+  inc term.kittyTmpSeq
+
+proc writeTempFile(path: string; data: openArray[uint8]): bool =
+  let ps = newPosixStream(path, O_CREAT or O_WRONLY or O_EXCL, 0o600)
+  if ps == nil:
+    return false
+  let res = ps.writeLoop(data).isOk
+  ps.sclose()
+  if not res:
+    discard unlink(cstring(path))
+  res
+
+# Images are output as PNG, except when the terminal reads them from temp
+# files; then we skip encoding and just send RGBA data.
+proc kittyTempFiles*(term: Terminal): bool =
+  term.imageMode == imKitty and term.kittyMedium == kmTempFile
+
 proc outputKittyImage(term: Terminal; x, y: int; image: CanvasImage):
     Opt[void] =
   ?term.cursorGoto(x, y)
@@ -2204,12 +2442,23 @@ proc outputKittyImage(term: Terminal; x, y: int; image: CanvasImage):
     inc term.kittyId
   image.kittyId = term.kittyId
   outs &= ",i=" & $image.kittyId
-  const MaxBytes = 4096 * 3 div 4
-  var i = MaxBytes
+  let f = if image.data.ctype == "image/png": "100" else: "32"
   let p = cast[ptr UncheckedArray[uint8]](image.data.buffer)
   let L = image.data.size
+  if term.kittyMedium == kmTempFile:
+    # The terminal reads (and then deletes) the file by itself, so all we
+    # send is the path.
+    let path = term.kittyTempPath()
+    if writeTempFile(path, p.toOpenArray(0, L - 1)):
+      outs &= ",a=T,t=t,f=" & f & ';'
+      outs.btoa(path.toOpenArrayByte(0, path.high))
+      outs &= ST
+      return term.write(outs)
+    # failed to write the file; fall back to direct transmission
+  const MaxBytes = 4096 * 3 div 4
+  var i = MaxBytes
   let m = if i < L: '1' else: '0'
-  outs &= ",a=T,f=100,m=" & m & ';'
+  outs &= ",a=T,f=" & f & ",m=" & m & ';'
   outs.btoa(p.toOpenArray(0, min(L, i) - 1))
   outs &= ST
   ?term.write(outs)
@@ -2279,9 +2528,9 @@ proc scrollUp*(term: Terminal; n, scrollBottom: int) =
     for x in 0 ..< term.attrs.width:
       let i = y * term.attrs.width + x
       let j = (y + n) * term.attrs.width + x
-      term.frame.canvas[j] = move(term.frame.canvas[i])
+      term.frame.canvas.moveCell(i, j)
   for y in 0 ..< n:
-    term.frame.lineDamage[y] = 0
+    term.damage(y, 0, term.attrs.width)
   let maxwpx = term.attrs.widthPx
   let maxhpx = scrollBottom * term.attrs.ppl
   let scrolled = term.imageMode == imSixel
@@ -2330,9 +2579,9 @@ proc scrollDown*(term: Terminal; n, scrollBottom: int) =
     for x in 0 ..< term.attrs.width:
       let i = y * term.attrs.width + x
       let j = (y - n) * term.attrs.width + x
-      term.frame.canvas[j] = move(term.frame.canvas[i])
+      term.frame.canvas.moveCell(i, j)
   for y in scrollBottom - n ..< scrollBottom:
-    term.frame.lineDamage[y] = 0
+    term.damage(y, 0, term.attrs.width)
   let maxwpx = term.attrs.widthPx
   let maxhpx = scrollBottom * term.attrs.ppl
   let scrolled = term.imageMode == imSixel
@@ -2487,10 +2736,28 @@ proc quit*(term: Terminal): Opt[void] =
       while true:
         if term.areadEvent().isErr:
           break
+    if term.kittyProbe != "": # never got a response
+      discard unlink(cstring(term.kittyProbe))
+      term.kittyProbe = ""
     ?term.disableRawMode()
     term.clearCanvas()
   ok()
 
+# Ask the terminal to load a 1x1 image from a temp file.  If it succeeds,
+# then it runs on the same machine as us, and we can send images through
+# the file system instead of base64 encoding them into the output.
+proc queryKittyTempFile(term: Terminal): Opt[void] =
+  if term.kittyProbe != "": # still waiting for the previous one
+    return ok()
+  let path = term.kittyTempPath()
+  if not writeTempFile(path, [0u8, 0u8, 0u8, 0u8]):
+    return ok()
+  term.kittyProbe = path
+  var s = KittyTempFileQueryStart
+  s.btoa(path.toOpenArrayByte(0, path.high))
+  s &= ST
+  term.write(s)
+
 proc setQueryState(term: Terminal; qs: QueryState) =
   if term.eparser.queryState == qsNone:
     term.eparser.queryState = qs
@@ -2519,9 +2786,12 @@ proc queryAttrs(term: Terminal; windowOnly: bool): Opt[void] =
       if term.config{"imageMode"}.isNone:
         if tfBleedsAPC notin term.desc:
           ?term.write(KittyQuery)
+          ?term.queryKittyTempFile()
         ?term.write(QueryColorRegisters)
       elif term.config{"imageMode"}.get == imSixel:
         ?term.write(QueryColorRegisters)
+      elif term.config{"imageMode"}.get == imKitty:
+        ?term.queryKittyTempFile()
       if term.attrs.colorMode < cmTrueColor and
           term.config{"colorMode"}.isNone:
         ?term.write(QueryTcapRGB)
@@ -2641,7 +2911,8 @@ proc detectTermAttributes(term: Terminal; windowOnly: bool): Opt[void] =
 proc initCanvas(term: Terminal) =
   for frame in term.frames.mitems:
     frame.lineDamage = newSeq[int](term.attrs.height)
-    frame.canvas = newSeq[FixedCell](term.attrs.width * term.attrs.height)
+    frame.cellDamage = newSeq[bool](term.attrs.width * term.attrs.height)
+    frame.canvas = newFixedGrid(term.attrs.width, term.attrs.height)
     frame.scrollBottom = -1
 
 proc windowChange(term: Terminal) =
@@ -2725,4 +2996,29 @@ proc newTerminal*(ostream: PosixStream; config: Config; loader: FileLoader):
     loader: loader
   )
 
+when defined(test):
+  # Set up a canvas of width x height cells without a terminal.
+  proc testInit*(term: Terminal; width, height: int) =
+    term.attrs.width = width
+    term.attrs.height = height
+    term.cs = csUtf8
+    term.initCanvas()
+
+  # Paint the damaged cells like draw does, and return the output instead
+  # of flushing it.
+  proc testDraw*(term: Terminal): string =
+    if not term.cleared:
+      doAssert term.fullDraw().isOk
+      term.cleared = true
+    else:
+      doAssert term.partialDraw(-1, defaultColor).isOk
+    result = ""
+    var page = term.frame.head
+    while page != nil:
+      for c in page.a:
+        result &= c
+      page = page.next
+    term.frame.head = nil
+    term.frame.tail = nil
+
 {.pop.} # raises: []
@@ -1,6 +1,8 @@
 {.push raises: [].}
 
+import std/hashes
 import std/macros
+import std/monotimes
 import std/options
 import std/posix
 import std/tables
@@ -47,6 +49,7 @@ import types/formdata
 import types/jsopt
 import types/opt
 import types/refstring
+import types/reshapestats
 import types/url
 import types/winattrs
 import utils/lrewrap
@@ -57,6 +60,14 @@ import utils/twtstr
 type
   InputData {.final.} = ref object of MapData
 
+  # Every match of a regex in the buffer, kept up to date on reshape.
+  SearchIndex = object
+    regex: Regex # bytecode is empty if there is no index
+    literal: RegexLiteral
+    lineHashes: seq[Hash] # hash of each line's text at the last update
+    matches: seq[BufferMatch] # sorted by y, then x
+    version: int # changes whenever matches does; see findAllMatches
+
   PagerHandle {.final.} = ref object of MapData
     tasks: array[BufferCommand, int]
     reportedLoad: LoadResult
@@ -64,6 +75,7 @@ type
     prevHover: Element
     next: PagerHandle
     hoverText: array[HoverType, string]
+    search: SearchIndex
 
   BufferContext {.final.} = ref object of RootObj
     firstBufferRead: bool
@@ -95,6 +107,7 @@ type
     luctx: LUContext
     nhints: int
     handlesHead: PagerHandle
+    reshapeStats: ReshapeStats # as of the end of the last reshape
 
   CommandResult = enum
     cmdrDone, cmdrEOF
@@ -425,6 +438,7 @@ proc findPrevMatch(bc: BufferContext; handle: PagerHandle; regex: Regex;
   var y = y
   var b = bc.cursorBytes(y, x)
   var first = true
+  let literal = regex.requiredLiteral()
   while true:
     if y < 0:
       if not wrap:
@@ -433,7 +447,10 @@ proc findPrevMatch(bc: BufferContext; handle: PagerHandle; regex: Regex;
     let s = bc.lines[y].str
     if b < 0:
       b = s.len
-    let cap = regex.matchLast(s.toOpenArray(0, b - 1), 0)
+    let cap = if literal.mayMatch(s.toOpenArray(0, b - 1)):
+      regex.matchLast(s.toOpenArray(0, b - 1), 0)
+    else:
+      (s: -1, e: -1)
     if cap.s >= 0:
       let x = s.width(0, cap.s)
       let w = s.toOpenArray(cap.s, cap.e - 1).width()
@@ -455,13 +472,17 @@ proc findNextMatch(bc: BufferContext; handle: PagerHandle; regex: Regex;
   var n = n
   var b = bc.cursorBytes(y, cursorx + 1)
   var first = true
+  let literal = regex.requiredLiteral()
   while true:
     if y >= bc.lines.len:
       if not wrap:
         break
       y = 0
     let s = bc.lines[y].str
-    let cap = regex.matchFirst(s, b)
+    let cap = if literal.mayMatch(s.toOpenArray(min(b, s.len), s.high)):
+      regex.matchFirst(s, b)
+    else:
+      (s: -1, e: -1)
     if cap.s >= 0:
       let x = s.width(0, cap.s)
       let w = s.toOpenArray(cap.s, cap.e - 1).width()
@@ -475,6 +496,96 @@ proc findNextMatch(bc: BufferContext; handle: PagerHandle; regex: Regex;
     inc y
   BufferMatch(x: -1, y: -1)
 
+proc `==`(a, b: BufferMatch): bool =
+  a.x == b.x and a.y == b.y and a.w == b.w
+
+# Add the matches of line y to matches.  Returns false if there are too many
+# matches to index.
+proc searchLine(search: SearchIndex; s: openArray[char]; y: int;
+    matches: var seq[BufferMatch]): bool =
+  if not search.literal.mayMatch(s):
+    return true
+  var x = 0
+  var b = 0
+  for cap in search.regex.matchCap(s, 0):
+    x += s.width(b, cap.s)
+    b = cap.s
+    let w = s.toOpenArray(cap.s, cap.e - 1).width()
+    matches.add(BufferMatch(x: x, y: y, w: w))
+    if matches.len > MaxIndexedMatches:
+      return false
+  true
+
+# Bring the index up to date with bc.lines.  Only lines between the
+# unchanged head and tail of the buffer are searched again.  On failure,
+# the index is dropped.
+proc updateSearch(bc: BufferContext; search: var SearchIndex): bool =
+  let oldHashes = move(search.lineHashes)
+  search.lineHashes = newSeq[Hash](bc.lines.len)
+  for y, line in bc.lines.mypairs:
+    search.lineHashes[y] = hash(line.str)
+  let L = min(oldHashes.len, search.lineHashes.len)
+  var head = 0
+  while head < L and oldHashes[head] == search.lineHashes[head]:
+    inc head
+  var tail = 0
+  while tail < L - head and
+      oldHashes[^(tail + 1)] == search.lineHashes[^(tail + 1)]:
+    inc tail
+  if head == L and oldHashes.len == search.lineHashes.len:
+    return true # nothing changed
+  let oldTail = oldHashes.len - tail
+  let newTail = search.lineHashes.len - tail
+  var matches: seq[BufferMatch] = @[]
+  var i = 0
+  while i < search.matches.len and search.matches[i].y < head:
+    matches.add(search.matches[i])
+    inc i
+  for y in head ..< newTail:
+    if not search.searchLine(bc.lines[y].str, y, matches):
+      search = SearchIndex(version: search.version + 1)
+      return false
+  while i < search.matches.len and search.matches[i].y < oldTail:
+    inc i
+  let dy = newTail - oldTail
+  while i < search.matches.len:
+    var match = search.matches[i]
+    match.y += dy
+    matches.add(match)
+    inc i
+  if matches.len > MaxIndexedMatches:
+    search = SearchIndex(version: search.version + 1)
+    return false
+  if matches != search.matches:
+    search.matches = move(matches)
+    inc search.version
+  true
+
+# version is that of the index the pager already has, or -1.  If it is
+# still current, the matches are not sent again.
+proc findAllMatches(bc: BufferContext; handle: PagerHandle; regex: Regex;
+    version: int): MatchIndex {.proxy.} =
+  if handle.search.regex.bytecode != regex.bytecode:
+    handle.search = SearchIndex(
+      regex: regex,
+      literal: regex.requiredLiteral(),
+      version: handle.search.version + 1
+    )
+    if not bc.updateSearch(handle.search):
+      return MatchIndex(regex: regex, complete: false)
+  elif handle.search.version == version:
+    return MatchIndex(regex: regex, complete: true, version: version,
+      unchanged: true)
+  MatchIndex(
+    regex: regex,
+    complete: true,
+    version: handle.search.version,
+    matches: handle.search.matches
+  )
+
+proc clearMatchIndex(bc: BufferContext; handle: PagerHandle) {.proxy.} =
+  handle.search = SearchIndex(version: handle.search.version + 1)
+
 proc gotoAnchor(bc: BufferContext; handle: PagerHandle; anchor: string;
     autofocus, target: bool): GotoAnchorResult {.proxy.} =
   if bc.document == nil:
@@ -553,11 +664,21 @@ proc maybeReshape(bc: BufferContext; suppressFouc = false) =
     # lost all elements (e.g. document.documentElement.remove() called)
     bc.lines.setLen(0)
   else:
+    var t = getMonoTime()
+    let styleNs = reshapeStats.styleNs
     let (stack, fixedHead) = rootElement.buildTree(bc.rootBox,
       bc.config.markLinks, bc.nhints, bc.linkHintChars)
+    reshapeStats.treeNs += t.lap() - (reshapeStats.styleNs - styleNs)
     bc.rootBox = BlockBox(stack.box)
     bc.rootBox.layout(bc.attrs, fixedHead, bc.luctx)
+    reshapeStats.layoutNs += t.lap()
     bc.lines.render(bc.bgcolor, stack, bc.attrs, bc.images)
+    reshapeStats.renderNs += t.lap()
+  reshapeStats.lines = bc.lines.len
+  bc.reshapeStats = reshapeStats.finishReshape()
+  for handle in bc.handles:
+    if handle.search.regex.bytecode.len > 0:
+      discard bc.updateSearch(handle.search)
   # We don't want a FOUC on automatic reshape, but we still want to allow
   # the user to override this and interact with the page (useful if e.g. a
   # sheet really doesn't want to load).
@@ -575,7 +696,10 @@ proc ensureLayout(bc: RootRef; element: Element) =
 
 proc processData0(bc: BufferContext; data: UnsafeSlice): bool =
   if bc.ishtml:
-    if bc.htmlParser.parseBuffer(data.toOpenArray()) == pcrStop:
+    var t = getMonoTime()
+    let res = bc.htmlParser.parseBuffer(data.toOpenArray())
+    reshapeStats.parseNs += t.lap()
+    if res == pcrStop:
       bc.charsetStack = @[bc.htmlParser.builder.charset]
       return false
   else:
@@ -606,8 +730,7 @@ proc switchCharset(bc: BufferContext) =
   bc.charset = bc.charsetStack.pop()
   bc.initDecoder()
   bc.htmlParser.restart(bc.charset)
-  bc.document.applyUASheet()
-  bc.document.applyUserSheet(bc.config.userStyle)
+  bc.document.applyUASheet(bc.config.userStyle)
   bc.document.invalid = true
 
 proc bomSniff(bc: BufferContext; iq: openArray[uint8]): int =
@@ -907,6 +1030,39 @@ proc getTitle(bc: BufferContext; handle: PagerHandle): string {.
   bc.savetask = true
   return ""
 
+proc getMemoryStats(bc: BufferContext; handle: PagerHandle): BufferMemoryStats
+    {.proxy.} =
+  result = BufferMemoryStats(jsMallocLimit: -1, heapBytes: getOccupiedMem())
+  if bc.config.scripting != smFalse:
+    let rt = JS_GetRuntime(bc.window.jsctx)
+    var usage: JSMemoryUsage
+    JS_ComputeMemoryUsage(rt, usage)
+    result.jsMallocSize = int(usage.malloc_size)
+    result.jsMallocLimit = int(usage.malloc_limit)
+    result.jsObjects = int(usage.obj_count)
+    result.jsGcThreshold = int(JS_GetGCThreshold(rt))
+  if bc.document != nil:
+    for node in bc.document.descendants:
+      inc result.nodes
+      if node of Element:
+        inc result.elements
+        if Element(node).computed != nil:
+          inc result.styles
+  result.lines = bc.lines.len
+  for line in bc.lines:
+    result.gridBytes += line.str.len + line.formats.len * sizeof(FormatCell)
+
+proc getReshapeStats(bc: BufferContext; handle: PagerHandle): ReshapeStats
+    {.proxy.} =
+  result = bc.reshapeStats
+  result.parseNs = reshapeStats.parseNs
+  result.bytesSent = reshapeStats.bytesSent
+  var usage: Rusage
+  if getrusage(RUSAGE_SELF, addr usage) == 0:
+    result.maxRss = int(usage.ru_maxrss)
+    when defined(macosx): # bytes, not KiB
+      result.maxRss = result.maxRss div 1024
+
 proc forceReshape(bc: BufferContext; handle: PagerHandle) {.proxy.} =
   if bc.document != nil and bc.document.documentElement != nil:
     bc.document.documentElement.invalidate()
@@ -1504,6 +1660,7 @@ proc getLinesCmd(bc: BufferContext; handle: PagerHandle; r: var PacketReader;
             image.y <= slice.b and ey >= slice.a:
           images.add(image)
     w.swrite(images) # images
+    reshapeStats.bytesSent += w.bufLen
   cmdrDone
 
 proc getSelectionText(bc: BufferContext; handle: PagerHandle;
@@ -1712,9 +1869,11 @@ proc hideHints(bc: BufferContext; handle: PagerHandle) {.proxy.} =
 const ProxyMap = [
   bcCancel: cancelCmd,
   bcCheckRefresh: checkRefreshCmd,
+  bcClearMatchIndex: clearMatchIndexCmd,
   bcClick: clickCmd,
   bcClone: cloneCmd,
   bcContextMenu: contextMenuCmd,
+  bcFindAllMatches: findAllMatchesCmd,
   bcFindNextLink: findNextLinkCmd,
   bcFindNextMatch: findNextMatchCmd,
   bcFindNextParagraph: findNextParagraphCmd,
@@ -1724,6 +1883,8 @@ const ProxyMap = [
   bcForceReshape: forceReshapeCmd,
   bcGetLines: getLinesCmd,
   bcGetLinks: getLinksCmd,
+  bcGetMemoryStats: getMemoryStatsCmd,
+  bcGetReshapeStats: getReshapeStatsCmd,
   bcGetSelectionText: getSelectionTextCmd,
   bcGetTitle: getTitleCmd,
   bcGotoAnchor: gotoAnchorCmd,
@@ -1793,7 +1954,7 @@ proc handleError(bc: BufferContext; fd: cint): bool =
 
 proc getPollTimeout(bc: BufferContext): cint =
   if bc.config.scripting != smFalse:
-    return bc.window.timeouts.sortAndGetTimeout()
+    return bc.window.timeouts.getTimeout()
   return -1
 
 proc runBuffer(bc: BufferContext) =
@@ -1835,7 +1996,8 @@ proc cleanup(bc: BufferContext) =
 proc launchBuffer*(config: BufferConfig; url: URL; attrs: WindowAttributes;
     ishtml: bool; charsetStack: seq[Charset]; loader: FileLoader;
     pstream, istream, urandom: PosixStream; cacheId: int; contentType: string;
-    linkHintChars: sink seq[uint32]; schemes: sink seq[string]) =
+    linkHintChars: sink seq[uint32]; schemes: sink seq[string];
+    prewarmed: Window = nil) =
   let confidence = if config.charsetOverride == csUnknown:
     ccTentative
   else:
@@ -1867,9 +2029,17 @@ proc launchBuffer*(config: BufferConfig; url: URL; attrs: WindowAttributes;
     config.imageTypes,
     config.userAgent,
     config.referrer,
-    contentType
+    contentType,
+    prewarmed
   )
   bc.window.bc = bc
+  if config.scripting != smFalse:
+    bc.window.settings.scriptCache = config.scriptCache
+    let rt = JS_GetRuntime(bc.window.jsctx)
+    if config.jsMemoryLimit > 0:
+      JS_SetMemoryLimit(rt, csize_t(config.jsMemoryLimit) * 1024 * 1024)
+    if config.jsGcThreshold > 0:
+      JS_SetGCThreshold(rt, csize_t(config.jsGcThreshold) * 1024)
   bc.charset = bc.charsetStack.pop()
   istream.setBlocking(false)
   bc.loader.put(InputData(stream: istream))
@@ -1877,8 +2047,7 @@ proc launchBuffer*(config: BufferConfig; url: URL; attrs: WindowAttributes;
   bc.addPagerHandle(pstream)
   bc.initDecoder()
   bc.htmlParser = newHTML5ParserWrapper(bc.window, url, confidence, bc.charset)
-  bc.document.applyUASheet()
-  bc.document.applyUserSheet(bc.config.userStyle)
+  bc.document.applyUASheet(bc.config.userStyle)
   bc.runBuffer()
   bc.cleanup()
   quit(0)
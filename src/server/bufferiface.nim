@@ -1,5 +1,6 @@
 {.push raises: [].}
 
+import std/algorithm
 import std/posix
 
 import encoding/charset
@@ -30,6 +31,7 @@ import types/jsopt
 import types/opt
 import types/referrer
 import types/refstring
+import types/reshapestats
 import types/url
 import types/winattrs
 import utils/lrewrap
@@ -40,9 +42,11 @@ type
   BufferCommand* = enum
     bcCancel = "cancel"
     bcCheckRefresh = "checkRefresh"
+    bcClearMatchIndex = "clearMatchIndex"
     bcClick = "click"
     bcClone = "clone"
     bcContextMenu = "contextMenu"
+    bcFindAllMatches = "findAllMatches"
     bcFindNextLink = "findNextLink"
     bcFindNextMatch = "findNextMatch"
     bcFindNextParagraph = "findNextParagraph"
@@ -52,6 +56,8 @@ type
     bcForceReshape = "forceReshape"
     bcGetLines = "getLines"
     bcGetLinks = "getLinks"
+    bcGetMemoryStats = "getMemoryStats"
+    bcGetReshapeStats = "getReshapeStats"
     bcGetSelectionText = "getSelectionText"
     bcGetTitle = "getTitle"
     bcGotoAnchor = "gotoAnchor"
@@ -94,13 +100,20 @@ type
     y2* {.jsgetset.}: int
 
   CachedImageState* = enum
-    cisLoading, cisCanceled, cisLoaded
+    cisLoading, cisCanceled, cisPreview, cisLoaded
+
+  CachedImageFrame* = object
+    data*: Blob # nil until loaded
+    cacheId*: int
+    delay*: int # in milliseconds
+    transparent*: bool
+    preludeLen*: int
 
   CachedImage* = ref object
     state*: CachedImageState
     width*: int
     height*: int
-    data*: Blob # mmapped blob of image data
+    data*: Blob # mmapped blob of image data (a preview in cisPreview)
     cacheId*: int # cache id of the file backing "data"
     bmp*: NetworkBitmap
     # Following variables are always 0 in kitty mode; they exist to support
@@ -117,6 +130,11 @@ type
     transparent*: bool
     # length of introducer, raster, palette data before pixel data
     preludeLen*: int
+    # Animated images only.  data, transparent and preludeLen are copied
+    # from the current frame.
+    frames*: seq[CachedImageFrame]
+    frame*: int # index of the current frame
+    frameExpires*: int64 # time to switch frames; -1 if paused
     next: CachedImage
 
   ImageCache = object
@@ -164,6 +182,26 @@ type
     y*: int
     w*: int
 
+  MatchIndex* = object
+    regex*: Regex
+    complete*: bool # false if there were too many matches to index
+    unchanged*: bool # the pager's copy is current; matches is empty
+    version*: int
+    matches*: seq[BufferMatch] # sorted by y, then x
+
+  # Memory accounting of a buffer process, for the memory usage view.
+  BufferMemoryStats* = object
+    jsMallocSize*: int # bytes allocated by the JS runtime
+    jsMallocLimit*: int # -1 if unlimited
+    jsGcThreshold*: int
+    jsObjects*: int
+    nodes*: int
+    elements*: int
+    styles*: int # elements with computed values
+    lines*: int
+    gridBytes*: int # text and formatting of the rendered grid
+    heapBytes*: int # occupied memory of the Nim heap
+
   ClickResult* = object
     case t*: ClickResultType
     of crtNone: discard
@@ -206,6 +244,9 @@ type
     markLinks*: bool
     charsetOverride*: Charset
     metaRefresh*: MetaRefresh
+    jsMemoryLimit*: int32 # MiB; 0 is unlimited
+    jsGcThreshold*: int32 # KiB; 0 is the QuickJS default
+    scriptCache*: bool
     charsets*: seq[Charset]
     imageTypes*: MimeTypesImages
     userAgent*: string
@@ -256,6 +297,9 @@ type
     numLines* {.jsget.}: int
     pos: CursorState
     highlights: seq[Highlight]
+    matchRegex: string # bytecode of the regex in matchIndex; empty if none
+    matchIndex: seq[BufferMatch]
+    matchVersion: int # version of matchIndex in the buffer
     images*: seq[PosBitmap]
     hoverText*: array[HoverType, string]
     phandle*: ProcessHandle
@@ -866,6 +910,9 @@ proc setCursorY(iface: BufferInterface; y: int; refresh = true) {.jsfunc.} =
 # Send/receive packets
 const ClickResultReadLine* = {crtReadText, crtReadPassword, crtReadFile}
 
+# Upper bound on the size of a match index; 100k matches are ~2.4 MB.
+const MaxIndexedMatches* = 100000
+
 proc initClickResult*(): ClickResult =
   ClickResult(t: crtNone)
 
@@ -987,6 +1034,18 @@ proc toJS(ctx: JSContext; x: CursorXY): JSValue =
   JS_FreeValue(ctx, obj)
   return JS_EXCEPTION
 
+proc toJS(ctx: JSContext; stats: BufferMemoryStats | ReshapeStats): JSValue =
+  let obj = JS_NewObject(ctx)
+  if JS_IsException(obj):
+    return JS_EXCEPTION
+  block good:
+    for k, v in stats.fieldPairs:
+      if ctx.definePropertyCWE(obj, k, ctx.toJS(v)) == dprException:
+        break good
+    return obj
+  JS_FreeValue(ctx, obj)
+  return JS_EXCEPTION
+
 proc toJS(ctx: JSContext; match: BufferMatch): JSValue =
   var init = [JS_UNDEFINED, JS_UNDEFINED, JS_UNDEFINED]
   block good:
@@ -1220,12 +1279,132 @@ proc findNextLink(ctx: JSContext; iface: BufferInterface; x, y, n: int): JSValue
     w.swrite(n)
   return addPromise[PagePos](ctx, iface)
 
+# Match index
+
+proc cmpMatch(match: BufferMatch; pos: tuple[x, y: int]): int =
+  let n = cmp(match.y, pos.y)
+  if n != 0:
+    return n
+  cmp(match.x, pos.x)
+
+proc hasMatchIndex(iface: BufferInterface): bool {.jsfget.} =
+  iface.matchRegex.len > 0
+
+proc indexes(iface: BufferInterface; p: pointer; plen: cint): bool =
+  let plen = int(plen)
+  return plen == iface.matchRegex.len and plen > 0 and
+    equalMem(p, addr iface.matchRegex[0], plen)
+
+proc findNextIndexedMatch(iface: BufferInterface; x, y: int; wrap: bool;
+    n: int): BufferMatch =
+  let L = iface.matchIndex.len
+  let i = iface.matchIndex.upperBound((x: x, y: y), cmpMatch)
+  var k = i + n - 1
+  if k >= L and wrap:
+    k -= L
+    if k >= i:
+      k = -1
+  if k notin 0 ..< L:
+    return BufferMatch(x: -1, y: -1)
+  iface.matchIndex[k]
+
+proc findPrevIndexedMatch(iface: BufferInterface; x, y: int; wrap: bool;
+    n: int): BufferMatch =
+  let L = iface.matchIndex.len
+  let i = iface.matchIndex.lowerBound((x: x, y: y), cmpMatch) - 1
+  var k = i - n + 1
+  if k < 0 and wrap:
+    k += L
+    if k <= i:
+      k = -1
+  if k notin 0 ..< L:
+    return BufferMatch(x: -1, y: -1)
+  iface.matchIndex[k]
+
+proc clearMatchIndex0(iface: BufferInterface) =
+  if iface.matchRegex.len > 0:
+    iface.matchRegex = ""
+    iface.matchIndex = @[]
+    iface.queueDraw()
+    iface.refreshStatus = true
+
+proc getMatchIndexFromStream(ctx: JSContext; iface: BufferInterface;
+    r: var PacketReader): JSValue =
+  var index: MatchIndex
+  r.sread(index)
+  if not index.complete:
+    iface.clearMatchIndex0()
+    return ctx.toJS(-1)
+  if index.unchanged:
+    return ctx.toJS(iface.matchIndex.len)
+  iface.matchRegex = move(index.regex.bytecode)
+  iface.matchVersion = index.version
+  iface.matchIndex = move(index.matches)
+  iface.queueDraw()
+  iface.refreshStatus = true
+  return ctx.toJS(iface.matchIndex.len)
+
+# Index every match of re in the buffer.  Once the index exists, matches are
+# highlighted, and findNextMatch/findPrevMatch use it for the same regex.
+# Resolves to the number of matches, or -1 if there were too many.
+proc findAllMatches(ctx: JSContext; iface: BufferInterface; re: JSValueConst):
+    JSValue {.jsfunc.} =
+  var bytecodeLen: cint
+  let p = JS_GetRegExpBytecode(ctx, re, bytecodeLen)
+  if p == nil:
+    return JS_EXCEPTION
+  let regex = bytecodeToRegex(cast[REBytecode](p), bytecodeLen)
+  ctx.withPacketWriter iface, bcFindAllMatches, w:
+    w.swrite(regex)
+    w.swrite(-1) # always send the matches
+  return ctx.addPromise(iface, getMatchIndexFromStream)
+
+# Fetch the index again after the buffer has been reshaped.  (The buffer
+# updates it on reshape, so this only re-sends the result, and only if it
+# changed since we last got it.)
+proc refreshMatchIndex(ctx: JSContext; iface: BufferInterface): JSValue
+    {.jsfunc.} =
+  if iface.matchRegex.len == 0:
+    return JS_UNDEFINED
+  ctx.withPacketWriter iface, bcFindAllMatches, w:
+    w.swrite(Regex(bytecode: iface.matchRegex))
+    w.swrite(iface.matchVersion)
+  return ctx.addPromise(iface, getMatchIndexFromStream)
+
+proc clearMatchIndex(ctx: JSContext; iface: BufferInterface): JSValue
+    {.jsfunc.} =
+  if iface.matchRegex.len == 0:
+    return JS_UNDEFINED
+  iface.clearMatchIndex0()
+  ctx.withPacketWriter iface, bcClearMatchIndex, w:
+    discard
+  return addEmptyPromise(ctx, iface)
+
+# "match k of N" if the cursor is on the kth match, "N matches" otherwise.
+proc matchStatus*(iface: BufferInterface): string =
+  if iface.matchRegex.len == 0:
+    return ""
+  let L = iface.matchIndex.len
+  if L == 0:
+    return "no matches"
+  let pos = (x: iface.cursorx, y: iface.cursory)
+  let i = iface.matchIndex.upperBound(pos, cmpMatch) - 1
+  if i >= 0:
+    let match = iface.matchIndex[i]
+    if match.y == pos.y and pos.x < match.x + max(match.w, 1):
+      return "match " & $(i + 1) & " of " & $L
+  if L == 1:
+    return "1 match"
+  return $L & " matches"
+
 proc findNextMatch(ctx: JSContext; iface: BufferInterface; re: JSValueConst;
     x, y: int; wrap: bool; n: int): JSValue {.jsfunc.} =
   var bytecodeLen: cint
   let p = JS_GetRegExpBytecode(ctx, re, bytecodeLen)
   if p == nil:
     return JS_EXCEPTION
+  if iface.indexes(p, bytecodeLen):
+    return ctx.toJS(iface.findNextIndexedMatch(x, y, wrap, n))
   let bytecode = cast[REBytecode](p)
   var wrap = wrap
   let endy = y
@@ -1233,6 +1412,7 @@ proc findNextMatch(ctx: JSContext; iface: BufferInterface; re: JSValueConst;
   var n = n
   var b = iface.cursorBytes(y, x + 1)
   var first = true
+  let literal = bytecode.requiredLiteral()
   while true:
     if y >= iface.numLines:
       if not wrap:
@@ -1250,7 +1430,10 @@ proc findNextMatch(ctx: JSContext; iface: BufferInterface; re: JSValueConst;
         w.swrite(n)
       return addPromise[BufferMatch](ctx, iface)
     let s = iface.getLineStr(y)
-    let cap = bytecode.matchFirst(s, b)
+    let cap = if literal.mayMatch(s.toOpenArray(min(b, s.len), s.high)):
+      bytecode.matchFirst(s, b)
+    else:
+      (s: -1, e: -1)
     if cap.s >= 0:
       let x = s.width(0, cap.s)
       let w = s.toOpenArray(cap.s, cap.e - 1).width()
@@ -1286,6 +1469,8 @@ proc findPrevMatch(ctx: JSContext; iface: BufferInterface; re: JSValueConst;
   let p = JS_GetRegExpBytecode(ctx, re, bytecodeLen)
   if p == nil:
     return JS_EXCEPTION
+  if iface.indexes(p, bytecodeLen):
+    return ctx.toJS(iface.findPrevIndexedMatch(x, y, wrap, n))
   let bytecode = cast[REBytecode](p)
   var wrap = wrap
   let endy = y
@@ -1293,6 +1478,7 @@ proc findPrevMatch(ctx: JSContext; iface: BufferInterface; re: JSValueConst;
   var y = y
   var b = iface.cursorStartByte(y, x)
   var first = true
+  let literal = bytecode.requiredLiteral()
   while true:
     if y < 0:
       if not wrap:
@@ -1312,7 +1498,10 @@ proc findPrevMatch(ctx: JSContext; iface: BufferInterface; re: JSValueConst;
     let s = iface.getLineStr(y)
     if b < 0:
       b = s.len
-    let cap = bytecode.matchLast(s.toOpenArray(0, b - 1))
+    let cap = if literal.mayMatch(s.toOpenArray(0, b - 1)):
+      bytecode.matchLast(s.toOpenArray(0, b - 1))
+    else:
+      (s: -1, e: -1)
     if cap.s >= 0:
       let x = s.width(0, cap.s)
       let w = s.toOpenArray(cap.s, cap.e - 1).width()
@@ -1469,6 +1658,44 @@ proc requestLinesSync*(ctx: JSContext; iface: BufferInterface;
         return irEOF
   irOk
 
+proc getMemoryStats(ctx: JSContext; iface: BufferInterface): JSValue
+    {.jsfunc.} =
+  ctx.withPacketWriter iface, bcGetMemoryStats, w:
+    discard
+  return addPromise[BufferMemoryStats](ctx, iface)
+
+proc getReshapeStats(ctx: JSContext; iface: BufferInterface): JSValue
+    {.jsfunc.} =
+  ctx.withPacketWriter iface, bcGetReshapeStats, w:
+    discard
+  return addPromise[ReshapeStats](ctx, iface)
+
+# Synchronously read the reshape statistics of the buffer, for headless
+# mode.  Returns null if the buffer is gone.
+proc getReshapeStatsSync(ctx: JSContext; iface: BufferInterface): JSValue
+    {.jsfunc.} =
+  if iface.dead:
+    return JS_NULL
+  iface.stream.setBlocking(true)
+  while iface.hasPromises:
+    if ctx.handleCommand(iface) != irOk:
+      return JS_NULL
+  let packetid = iface.packetid
+  iface.withPacketWriterSync bcGetReshapeStats, w:
+    discard
+  do:
+    return JS_NULL
+  inc iface.packetid
+  var stats = ReshapeStats()
+  iface.stream.withPacketReader r:
+    var packetid2: int
+    r.sread(packetid2)
+    assert packetid == packetid2
+    r.sread(stats)
+  do:
+    return JS_NULL
+  return ctx.toJS(stats)
+
 proc getSelectionText(ctx: JSContext; iface: BufferInterface;
     sx, sy, ex, ey: int; t: SelectionType): JSValue {.jsfunc.} =
   ctx.withPacketWriter iface, bcGetSelectionText, w:
@@ -1657,7 +1884,7 @@ proc removeHighlight(iface: BufferInterface; highlight: Highlight) {.jsfunc.} =
   iface.queueDraw()
 
 # Image
-iterator cachedImages(iface: BufferInterface): CachedImage =
+iterator cachedImages*(iface: BufferInterface): CachedImage =
   var it = iface.imageCache.head
   while it != nil:
     yield it
@@ -1674,12 +1901,23 @@ proc findCachedImage*(iface: BufferInterface;
 
 proc clearCachedImages*(iface: BufferInterface; loader: FileLoader) =
   for cachedImage in iface.cachedImages:
-    if cachedImage.state == cisLoaded:
+    if cachedImage.frames.len > 0:
+      for frame in cachedImage.frames:
+        if frame.data != nil:
+          loader.removeCachedItem(frame.cacheId)
+    elif cachedImage.state in {cisPreview, cisLoaded}:
       loader.removeCachedItem(cachedImage.cacheId)
     cachedImage.state = cisCanceled
   iface.imageCache.head = nil
   iface.imageCache.tail = nil
 
+proc setFrame*(image: CachedImage; i: int) =
+  let frame = addr image.frames[i]
+  image.frame = i
+  image.data = frame.data
+  image.transparent = frame.transparent
+  image.preludeLen = frame.preludeLen
+
 proc addCachedImage*(iface: BufferInterface; image: CachedImage) =
   if iface.imageCache.tail == nil:
     iface.imageCache.head = image
@@ -1741,14 +1979,15 @@ proc setFormat(cell: var FixedCell; cf: SimpleFormatCell; bgcolor: CellColor) =
   if bgcolor != defaultColor and cell.format.bgcolor == defaultColor:
     cell.format.bgcolor = bgcolor
 
-proc setText(cell: var FixedCell; u: uint32; i, pi, uw: int;
+proc setText(display: var FixedGrid; n: int; u: uint32; i, pi: int;
     s: openArray[char]) =
   if u.isControlChar():
-    cell.str = u.controlToVisual()
+    display.setText(n, u.controlToVisual())
   elif u in TabPUARange:
-    cell.str = ' '.repeat(uw)
+    # the rest of the tab is filled in by drawLines
+    display.setText(n, ' ')
   else:
-    cell.str = s.toOpenArray(pi, i - 1).substr()
+    display.setText(n, s.toOpenArray(pi, i - 1))
 
 proc drawLines*(iface: BufferInterface; display: var FixedGrid;
     hlcolor: CellColor) =
@@ -1770,7 +2009,7 @@ proc drawLines*(iface: BufferInterface; display: var FixedGrid;
     var nf = line.findNextFormat(w)
     var k = 0
     while k < w - iface.pos.fromx:
-      display[dls + k] = FixedCell(str: " ")
+      display.setText(dls + k, ' ')
       display[dls + k].setFormat(cf, bgcolor)
       inc k
     let startw = w # save this for later
@@ -1786,20 +2025,28 @@ proc drawLines*(iface: BufferInterface; display: var FixedGrid;
       if nf.pos != -1 and nf.pos <= pw:
         cf = nf
         nf = line.findNextFormat(pw)
-      display[dls + k].setText(u, i, pi, uw, line.str)
+      display.setText(dls + k, u, i, pi, line.str)
       display[dls + k].setFormat(cf, bgcolor)
       inc k
-      for i in 1 ..< uw:
-        display[dls + k] = FixedCell()
-        inc k
+      if u in TabPUARange:
+        # tabs are spaces in the same format
+        for i in 1 ..< uw:
+          display.setText(dls + k, ' ')
+          display[dls + k].setFormat(cf, bgcolor)
+          inc k
+      else:
+        for i in 1 ..< uw:
+          display.clear(dls + k)
+          inc k
     if bgcolor != defaultColor:
       # Fill the screen if bgcolor is not default.
       let format = initFormat(bgcolor, defaultColor, {})
-      for cell in display.mline(by, k):
-        cell = FixedCell(str: " ", format: format)
+      for n in dls + k ..< dls + display.width:
+        display.setText(n, ' ')
+        display[n].format = format
     else:
-      for cell in display.mline(by, k):
-        cell = FixedCell()
+      for n in dls + k ..< dls + display.width:
+        display.clear(n)
     # Finally, override cell formatting for highlighted cells.
     let aw = display.width - (startw - iface.pos.fromx) # actual width
     let y = iface.pos.fromy + by
@@ -1815,10 +2062,21 @@ proc drawLines*(iface: BufferInterface; display: var FixedGrid;
           display[n].format.bgcolor = hlcolor
         else:
           display[n].format.incl(ffReverse)
+    if iface.matchRegex.len > 0:
+      var j = iface.matchIndex.lowerBound((x: 0, y: y), cmpMatch)
+      while j < iface.matchIndex.len and iface.matchIndex[j].y == y:
+        let match = iface.matchIndex[j]
+        let sx = max(match.x - iface.pos.fromx, 0)
+        let ex = min(match.x + match.w - iface.pos.fromx, display.width)
+        for n in dls + sx ..< dls + ex:
+          if hlcolor != defaultColor:
+            display[n].format.bgcolor = hlcolor
+          else:
+            display[n].format.incl(ffReverse)
+        inc j
     inc by
-  for y in by ..< display.height: # clear the rest
-    for cell in display.mline(y):
-      cell = FixedCell()
+  for n in by * display.width ..< display.len: # clear the rest
+    display.clear(n)
 
 proc addBufferInterfaceModule*(ctx: JSContext): Opt[void] =
   ?ctx.registerType(BufferInterface)
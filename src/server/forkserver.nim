@@ -4,8 +4,11 @@ import std/os
 import std/posix
 
 import config/config
+import config/conftypes
 import config/mailcap
 import encoding/charset
+import html/dom
+import html/env
 import io/chafile
 import io/dynstream
 import io/packetreader
@@ -38,6 +41,10 @@ type
     pollData: PollData
     linkHintChars: seq[uint32]
     schemes: seq[string]
+    # Connection to the buffer template process, which has a JS context
+    # ready for scripting buffers to fork from.
+    templateStream: PosixStream
+    templateFailed: bool
 
 proc loadConfig*(forkserver: ForkServer; config: Config;
     warnings: var seq[string]): int =
@@ -52,6 +59,7 @@ proc loadConfig*(forkserver: ForkServer; config: Config;
       dataDir: config.dataDir,
       bookmark: config{"bookmark"},
       maxNetConnections: config{"maxNetConnections"},
+      styleCache: config{"styleCache"},
     ))
     # client config for pager
     w.swrite(LoaderClientConfig(
@@ -131,7 +139,12 @@ proc forkLoader(ctx: var ForkServerContext; config: LoaderConfig;
     loaderStream.sclose()
     return (int(pid), newPosixStream(sv[0]))
 
-proc forkBuffer(ctx: var ForkServerContext; r: var PacketReader): int =
+proc forkFromTemplate(ctx: var ForkServerContext; config: BufferConfig;
+    url: URL; attrs: WindowAttributes; ishtml: bool;
+    charsetStack: seq[Charset]; contentType: string; fd: cint): int
+
+proc forkBuffer(ctx: var ForkServerContext; r: var PacketReader;
+    prewarmed: Window = nil): int =
   var config: BufferConfig
   var url: URL
   var attrs: WindowAttributes
@@ -145,12 +158,25 @@ proc forkBuffer(ctx: var ForkServerContext; r: var PacketReader): int =
   r.sread(charsetStack)
   r.sread(contentType)
   let fd = r.recvFd()
+  if prewarmed == nil and config.scripting != smFalse:
+    let pid = ctx.forkFromTemplate(config, url, attrs, ishtml, charsetStack,
+      contentType, fd)
+    if pid != -1:
+      discard close(fd)
+      return pid
+  # Parse and hash the UA sheets here, so that the buffer (and the next
+  # ones with the same environment) inherit them.
+  prepareUASheets(attrs, config.scripting, config.headless, contentType,
+    config.userStyle)
   stderr.flushFile()
   let pid = fork()
   if pid == 0:
     # child process
     ctx.stream.sclose()
-    ctx.loaderStream.sclose()
+    if ctx.loaderStream != nil:
+      ctx.loaderStream.sclose()
+    if ctx.templateStream != nil:
+      ctx.templateStream.sclose()
     setBufferProcessTitle(url)
     let pid = getCurrentProcessId()
     let urandom = newPosixStream("/dev/urandom", O_RDONLY, 0)
@@ -171,11 +197,87 @@ proc forkBuffer(ctx: var ForkServerContext; r: var PacketReader): int =
     enterBufferSandbox()
     launchBuffer(config, url, attrs, ishtml, charsetStack, loader, pstream,
       istream, urandom, cacheId, contentType, move(ctx.linkHintChars),
-      move(ctx.schemes))
+      move(ctx.schemes), prewarmed)
     doAssert false
   discard close(fd)
   return pid
 
+# The template process sets up a JS context once, and then forks a buffer
+# from it for each request of the fork server.  Forked buffers inherit the
+# registered bindings, so they skip most of the JS startup cost.
+proc runBufferTemplate(ctx: var ForkServerContext) =
+  setProcessTitle("cha buffer template")
+  let prewarmed = newScriptingWindow()
+  block mainLoop:
+    while true:
+      ctx.stream.withPacketReader r:
+        let pid = ctx.forkBuffer(r, prewarmed)
+        ctx.stream.withPacketWriter w:
+          w.swrite(pid)
+        do:
+          break mainLoop # EOF
+      do:
+        break mainLoop # EOF
+  quit(0)
+
+# `fd' is the buffer socket of the request being served; the template must
+# not keep it open.
+proc forkTemplate(ctx: var ForkServerContext; fd: cint) =
+  var sv {.noinit.}: array[2, cint]
+  if socketpair(AF_UNIX, SOCK_STREAM, IPPROTO_IP, sv) != 0:
+    ctx.templateFailed = true
+    return
+  stderr.flushFile()
+  let pid = fork()
+  if pid == 0:
+    # child process
+    ctx.stream.sclose()
+    ctx.loaderStream.sclose()
+    ctx.loaderStream = nil
+    discard close(fd)
+    discard close(sv[0])
+    ctx.stream = newPosixStream(sv[1])
+    ctx.runBufferTemplate()
+  discard close(sv[1])
+  if pid == -1:
+    discard close(sv[0])
+    ctx.templateFailed = true
+  else:
+    ctx.templateStream = newPosixStream(sv[0])
+
+proc forkFromTemplate(ctx: var ForkServerContext; config: BufferConfig;
+    url: URL; attrs: WindowAttributes; ishtml: bool;
+    charsetStack: seq[Charset]; contentType: string; fd: cint): int =
+  if ctx.templateFailed:
+    return -1
+  if ctx.templateStream == nil:
+    # Spawn the template on the first request for a scripting buffer, so
+    # that we do not waste memory if scripting is never enabled.  This
+    # buffer still starts the slow way.
+    ctx.forkTemplate(fd)
+    return -1
+  var pid = -1
+  var fail = false
+  ctx.templateStream.withPacketWriter w:
+    w.swrite(config)
+    w.swrite(url)
+    w.swrite(attrs)
+    w.swrite(ishtml)
+    w.swrite(charsetStack)
+    w.swrite(contentType)
+    w.sendFd(dup(fd)) # sendFd consumes it
+  do:
+    fail = true
+  if not fail:
+    ctx.templateStream.withPacketReaderFire r:
+      r.sread(pid)
+  if pid == -1:
+    # the template is gone; fall back to forking buffers ourselves
+    ctx.templateStream.sclose()
+    ctx.templateStream = nil
+    ctx.templateFailed = true
+  return pid
+
 proc forkCGI(ctx: var ForkServerContext; r: var PacketReader): int {.noinit.} =
   var hasIstream: bool
   r.sread(hasIstream)
@@ -193,6 +295,8 @@ proc forkCGI(ctx: var ForkServerContext; r: var PacketReader): int {.noinit.} =
   if pid == 0: # child
     ctx.stream.sclose()
     ctx.loaderStream.sclose()
+    if ctx.templateStream != nil:
+      ctx.templateStream.sclose()
     # we leave stderr open, so it can be seen in the browser console
     if istream != nil:
       istream.moveFd(STDIN_FILENO)
@@ -32,6 +32,7 @@ import config/conftypes
 import config/cookie
 import config/mailcap
 import html/script
+import io/chafile
 import io/dynstream
 import io/packetreader
 import io/packetwriter
@@ -128,6 +129,8 @@ type
     # Requests that will only be sent once n no longer exceeds
     # maxNetConnections.
     pending: seq[(InputHandle, RawRequest, URL)]
+    # Persistent storage log of the client's origin, once it was used.
+    storageLog: StorageLog
 
   DownloadItem = ref object
     escapedPath: string
@@ -161,6 +164,23 @@ type
     cookieStream: InputHandle
     pendingConnections: seq[ClientHandle]
     browsecap: Mailcap
+    storageMap: Table[string, StorageLog] # path -> log
+    parseCaches: array[ParseCacheKind, ParseCacheIndex]
+
+  # Replayed contents of a persistent storage log.
+  StorageLog = ref object
+    path: string
+    map: Table[string, string]
+    size: int # total length of keys and values
+    logSize: int # length of the log file, including pending
+    pending: string # records not yet appended to the file
+    refc: int # number of clients using the log
+
+  # Entries of one kind of parse cache, least recently used first.
+  ParseCacheIndex = object
+    loaded: bool # entries left by previous sessions have been added
+    size: int # total size of the entries
+    entries: OrderedTable[string, int] # path -> size
 
   LoaderConfig* = object
     cgiDir*: seq[string]
@@ -170,6 +190,7 @@ type
     dataDir*: string
     bookmark*: string
     maxNetConnections*: int
+    styleCache*: bool
 
   PushBufferResult = enum
     pbrDone, pbrUnregister
@@ -1680,6 +1701,321 @@ proc openCachedItemCmd(ctx: var LoaderContext; rclient: ClientHandle;
     return cmdrEOF
   cmdrDone
 
+# Parsed page resources are stored in tmpdir/<kind>/<origin>/<key>, where
+# kind is "csscache" for the tokens of style sheets.  (Script bytecode is
+# not cached here, as QuickJS cannot verify bytecode it did not write
+# itself.)  Buffers never touch these files directly: they send us
+# the data and receive a read-only fd in return.  Entries are partitioned
+# by the client's origin, so a buffer can only load data that was
+# produced by a buffer of the same origin.
+#
+# Each kind is capped in total size and number of entries (across all
+# origins); when a new entry exceeds the cap, the least recently used ones
+# are deleted.  Entries found on disk from previous sessions are ordered
+# by their mtime.
+const ParseCacheMaxSize = 4 * 1024 * 1024 # bytes
+const ParseCacheMaxTotal = 64 * 1024 * 1024 # bytes
+const ParseCacheMaxEntries = 4096
+const ParseCacheKeyMaxLen = 64
+
+# File name for data partitioned by the client's origin, or "" if the
+# origin is opaque.
+proc getOriginFileName(client: ClientHandle): string =
+  let url = client.config.originURL
+  if url == nil:
+    return ""
+  let origin = url.origin
+  if origin.t == otOpaque:
+    return ""
+  return ($origin).percentEncode(AllChars - AsciiAlphaNumeric - {'-', '.'})
+
+# Paths of the entries in the directory at path, except "." and "..".
+iterator dirEntries(path: string): string =
+  let d = opendir(cstring(path))
+  if d != nil:
+    while (let x = readdir(d); x != nil):
+      let name = $cast[cstring](addr x.d_name)
+      if name != "." and name != "..":
+        yield path / name
+    discard closedir(d)
+
+proc loadParseCacheIndex(ctx: var LoaderContext; kind: ParseCacheKind) =
+  let index = addr ctx.parseCaches[kind]
+  if index.loaded:
+    return
+  index.loaded = true
+  var found: seq[tuple[mtime: int64; size: int; path: string]] = @[]
+  for dir in dirEntries(ctx.config.tmpdir / $kind):
+    for path in dirEntries(dir):
+      var stats: Stat
+      if lstat(cstring(path), stats) == 0 and S_ISREG(stats.st_mode):
+        found.add((int64(stats.st_mtime), int(stats.st_size), path))
+  found.sort(proc(a, b: tuple[mtime: int64; size: int; path: string]): int =
+    cmp(a.mtime, b.mtime))
+  for it in found:
+    index.entries[it.path] = it.size
+    index.size += it.size
+
+# Move the entry at path to the end of the LRU order.
+proc touchParseCache(ctx: var LoaderContext; kind: ParseCacheKind;
+    path: string) =
+  let index = addr ctx.parseCaches[kind]
+  var size: int
+  if index.entries.pop(path, size):
+    index.entries[path] = size
+
+# Record an entry of size bytes at path, then delete the least recently
+# used entries until the cache is within its limits again.
+proc addParseCache(ctx: var LoaderContext; kind: ParseCacheKind;
+    path: string; size: int) =
+  let index = addr ctx.parseCaches[kind]
+  var osize: int
+  if index.entries.pop(path, osize):
+    index.size -= osize
+  index.entries[path] = size
+  index.size += size
+  while index.size > ParseCacheMaxTotal or
+      index.entries.len > ParseCacheMaxEntries:
+    var victim = ""
+    for it in index.entries.keys:
+      victim = it
+      break
+    discard index.entries.pop(victim, osize)
+    index.size -= osize
+    discard unlink(cstring(victim))
+
+# Read the kind and key of a parse cache command, and return the path of
+# the entry, or "" if it must not be cached.  sread would cast any int to
+# the enum, so the kind is range checked first.
+proc readParseCacheKey(ctx: LoaderContext; client: ClientHandle;
+    r: var PacketReader; kind: var ParseCacheKind): string =
+  var n: int
+  var key: string
+  r.sread(n)
+  r.sread(key)
+  if n notin int(ParseCacheKind.low) .. int(ParseCacheKind.high):
+    return ""
+  kind = ParseCacheKind(n)
+  let enabled = case kind
+  of pckStyle: ctx.config.styleCache
+  if not enabled or key.len == 0 or key.len > ParseCacheKeyMaxLen or
+      AllChars - AsciiHexDigit in key:
+    return ""
+  let name = client.getOriginFileName()
+  if name == "":
+    return ""
+  return ctx.config.tmpdir / $kind / name / key
+
+proc getParseCacheCmd(ctx: var LoaderContext; rclient: ClientHandle;
+    r: var PacketReader): CommandResult =
+  var kind = ParseCacheKind.low
+  let path = ctx.readParseCacheKey(rclient, r, kind)
+  let ps = newPosixStream(path)
+  if ps != nil:
+    ctx.loadParseCacheIndex(kind)
+    ctx.touchParseCache(kind, path)
+  rclient.withPacketWriter w:
+    w.swrite(path != "")
+    if path != "":
+      w.swrite(ps != nil)
+      if ps != nil:
+        w.sendFd(ps.fd)
+  do:
+    return cmdrEOF
+  cmdrDone
+
+proc putParseCacheCmd(ctx: var LoaderContext; rclient: ClientHandle;
+    r: var PacketReader): CommandResult =
+  var kind = ParseCacheKind.low
+  var data: string
+  let path = ctx.readParseCacheKey(rclient, r, kind)
+  r.sread(data)
+  if path != "" and data.len in 1..ParseCacheMaxSize:
+    discard mkdir(cstring(ctx.config.tmpdir), 0o700)
+    discard mkdir(cstring(ctx.config.tmpdir / $kind), 0o700)
+    discard mkdir(cstring(path.parentDir()), 0o700)
+    ctx.loadParseCacheIndex(kind)
+    # write to a temporary file first, so that readers never see a partial
+    # entry
+    let tmpf = ctx.getTempFile()
+    if chafile.writeFile(tmpf, data, 0o600).isErr or
+        chafile.rename(tmpf, path).isErr:
+      discard unlink(cstring(tmpf))
+    else:
+      ctx.addParseCache(kind, path, data.len)
+  cmdrDone
+
+# Persistent localStorage is kept in dataDir/storage/<origin>, as a log of
+# records appended whenever a buffer changes it.  Each record is a line of
+# the form "<op><key length> <value length>", followed by the key, the
+# value and a newline.  Logs are replayed into memory on first use, and
+# rewritten from memory once they have grown to more than twice the size
+# of the live data.
+#
+# New records are buffered, and only appended to the file once enough of
+# them have accumulated, when the last client using the log goes away (at
+# which point the log is dropped from memory) or when the loader exits.
+const StorageOpChars: array[StorageOp, char] = ['S', 'R', 'C']
+const StorageCompactMinSize = 65536 # bytes
+const StorageFlushSize = 4096 # bytes
+
+proc getStoragePath(ctx: LoaderContext; client: ClientHandle): string =
+  if not client.config.persistentStorage or ctx.config.dataDir == "":
+    return ""
+  let name = client.getOriginFileName()
+  if name == "":
+    return ""
+  return ctx.config.dataDir / "storage" / name
+
+proc addStorageRecord(s: var string; op: StorageOp; key, value: string) =
+  s &= StorageOpChars[op]
+  s &= $key.len & ' ' & $value.len & '\n'
+  s &= key
+  s &= value
+  s &= '\n'
+
+# Returns false if the change would exceed the quota.
+proc apply(log: StorageLog; op: StorageOp; key, value: string): bool =
+  case op
+  of soSet:
+    var size = log.size + value.len
+    if key in log.map:
+      size -= log.map[key].len
+    else:
+      size += key.len
+    if size > StorageQuota:
+      return false
+    log.size = size
+    log.map[key] = value
+  of soRemove:
+    var old: string
+    if log.map.pop(key, old):
+      log.size -= key.len + old.len
+  of soClear:
+    log.map.clear()
+    log.size = 0
+  true
+
+# Returns false if the log is damaged (e.g. by a truncated write); the
+# records before the damage are still applied.
+proc replay(log: StorageLog; s: string): bool =
+  var i = 0
+  while i < s.len:
+    let j = s.find('\n', i)
+    if j == -1:
+      return false
+    let k = s.find(' ', i)
+    if k == -1 or k > j:
+      return false
+    let klen = parseIntP(s.toOpenArray(i + 1, k - 1)).get(-1)
+    let vlen = parseIntP(s.toOpenArray(k + 1, j - 1)).get(-1)
+    if klen notin 0..s.len or vlen notin 0..s.len:
+      return false
+    let e = j + 1 + klen + vlen # position of the trailing newline
+    if e >= s.len or s[e] != '\n':
+      return false
+    let op = case s[i]
+    of 'S': soSet
+    of 'R': soRemove
+    of 'C': soClear
+    else: return false
+    discard log.apply(op, s.substr(j + 1, j + klen), s.substr(j + klen + 1,
+      e - 1))
+    i = e + 1
+  true
+
+proc compactStorage(log: StorageLog) =
+  var s = ""
+  for key, value in log.map:
+    s.addStorageRecord(soSet, key, value)
+  let tmpf = log.path & ".tmp"
+  if chafile.writeFile(tmpf, s, 0o600).isOk and
+      chafile.rename(tmpf, log.path).isOk:
+    log.logSize = s.len
+    log.pending = ""
+  else:
+    discard unlink(cstring(tmpf))
+
+proc flushStorage(log: StorageLog) =
+  if log.pending.len > 0:
+    let file = chafile.fopen(log.path, "a")
+    if file.isOk:
+      if file.get.write(log.pending).isErr:
+        log.logSize -= log.pending.len
+      file.get.close()
+    else:
+      log.logSize -= log.pending.len
+    log.pending = ""
+
+proc getStorageLog(ctx: var LoaderContext; client: ClientHandle;
+    path: string): StorageLog =
+  if client.storageLog != nil:
+    return client.storageLog
+  result = ctx.storageMap.getOrDefault(path)
+  if result == nil:
+    result = StorageLog(path: path)
+    var s: string
+    if chafile.readFile(path, s).isOk:
+      result.logSize = s.len
+      if not result.replay(s):
+        result.compactStorage()
+    ctx.storageMap[path] = result
+  inc result.refc
+  client.storageLog = result
+
+# Called when client is removed; drop the log once nobody refers to it.
+proc releaseStorageLog(ctx: var LoaderContext; client: ClientHandle) =
+  let log = client.storageLog
+  if log != nil:
+    client.storageLog = nil
+    dec log.refc
+    if log.refc <= 0:
+      log.flushStorage()
+      ctx.storageMap.del(log.path)
+
+proc getStorageCmd(ctx: var LoaderContext; rclient: ClientHandle;
+    r: var PacketReader): CommandResult =
+  let path = ctx.getStoragePath(rclient)
+  let log = if path != "": ctx.getStorageLog(rclient, path) else: nil
+  rclient.withPacketWriter w:
+    w.swrite(log != nil)
+    if log != nil:
+      w.swrite(log.map.len)
+      for key, value in log.map:
+        w.swrite(key)
+        w.swrite(value)
+  do:
+    return cmdrEOF
+  cmdrDone
+
+proc updateStorageCmd(ctx: var LoaderContext; rclient: ClientHandle;
+    r: var PacketReader): CommandResult =
+  var n: int
+  var key: string
+  var value: string
+  r.sread(n)
+  r.sread(key)
+  r.sread(value)
+  # sread would cast any int to the enum, so check the range first
+  if n notin int(StorageOp.low) .. int(StorageOp.high):
+    return cmdrDone
+  let op = StorageOp(n)
+  let path = ctx.getStoragePath(rclient)
+  if path != "":
+    let log = ctx.getStorageLog(rclient, path)
+    if log.apply(op, key, value):
+      discard mkdir(cstring(ctx.config.dataDir), 0o700)
+      discard mkdir(cstring(path.parentDir()), 0o700)
+      if log.logSize > StorageCompactMinSize and log.logSize > log.size * 2:
+        log.compactStorage()
+      else:
+        let olen = log.pending.len
+        log.pending.addStorageRecord(op, key, value)
+        log.logSize += log.pending.len - olen
+        if log.pending.len >= StorageFlushSize:
+          log.flushStorage()
+  cmdrDone
+
 proc passFdCmd(ctx: var LoaderContext; rclient: ClientHandle;
     r: var PacketReader): CommandResult =
   var id: string
@@ -1810,10 +2146,13 @@ const CommandMap = [
   lcAddClient: addClientCmd,
   lcAddPipe: addPipeCmd,
   lcGetCacheFile: getCacheFileCmd,
+  lcGetParseCache: getParseCacheCmd,
+  lcGetStorage: getStorageCmd,
   lcLoad: loadCmd,
   lcLoadConfig: loadConfigCmd,
   lcOpenCachedItem: openCachedItemCmd,
   lcPassFd: passFdCmd,
+  lcPutParseCache: putParseCacheCmd,
   lcRedirectToFile: redirectToFileCmd,
   lcRemoveCachedItem: removeCachedItemCmd,
   lcRemoveClient: removeClientCmd,
@@ -1821,11 +2160,13 @@ const CommandMap = [
   lcShareCachedItem: shareCachedItemCmd,
   lcSuspend: suspendCmd,
   lcTee: teeCmd,
+  lcUpdateStorage: updateStorageCmd,
 ]
 
 const UnprivilegedCommands = {
-  lcAddCacheFile, lcAddPipe, lcLoad, lcRemoveCachedItem, lcResume, lcSuspend,
-  lcTee
+  lcAddCacheFile, lcAddPipe, lcGetParseCache, lcGetStorage, lcLoad,
+  lcPutParseCache, lcRemoveCachedItem, lcResume, lcSuspend, lcTee,
+  lcUpdateStorage
 }
 const PrivilegedCommands = {LoaderCommand.low .. LoaderCommand.high} -
   UnprivilegedCommands
@@ -1851,6 +2192,8 @@ proc exitLoader(ctx: LoaderContext) =
         dec it.refc
         if it.refc <= 0:
           discard unlink(cstring(it.path))
+  for log in ctx.storageMap.values:
+    log.flushStorage()
   exitnow(1)
 
 # This is only called when an OutputHandle could not read enough of one (or
@@ -1918,6 +2261,7 @@ proc finishCycle(ctx: var LoaderContext) =
       # Do it in this exact order, or the cleanup procedure will have
       # trouble finding all clients if we got interrupted in this loop.
       ctx.unregister(client)
+      ctx.releaseStorageLog(client)
       let fd = int(client.stream.fd)
       ctx.close(client)
       if fd < ctx.handleMap.len:
@@ -63,16 +63,23 @@ type
     opaque*: RootRef
     request: Request
 
+  # Caches of parsed page resources, kept by the loader in tmpdir.
+  ParseCacheKind* = enum
+    pckStyle = "csscache" # style sheet tokens
+
   LoaderCommand* = enum
     lcAddAuth
     lcAddCacheFile
     lcAddClient
     lcAddPipe
     lcGetCacheFile
+    lcGetParseCache
+    lcGetStorage
     lcLoad
     lcLoadConfig
     lcOpenCachedItem
     lcPassFd
+    lcPutParseCache
     lcRedirectToFile
     lcRemoveCachedItem
     lcRemoveClient
@@ -80,6 +87,10 @@ type
     lcShareCachedItem
     lcSuspend
     lcTee
+    lcUpdateStorage
+
+  StorageOp* = enum
+    soSet, soRemove, soClear
 
   ClientKey* = array[32, uint8]
 
@@ -93,6 +104,7 @@ type
     insecureSslNoVerify*: bool
     referrerPolicy*: ReferrerPolicy
     cookieMode*: CookieMode
+    persistentStorage*: bool
 
   ResponseType* = enum
     rtDefault = "default"
@@ -748,6 +760,66 @@ proc openCachedItem*(loader: FileLoader; cacheId: int): PosixStream =
     return newPosixStream(fd)
   return nil
 
+proc getParseCache*(loader: FileLoader; kind: ParseCacheKind; key: string):
+    Opt[PosixStream] =
+  ## Open the entry cached for `key`, or return nil if it is missing.
+  ## Returns err() if the loader does not keep a cache of this kind for us.
+  loader.withPacketWriter w:
+    w.swrite(lcGetParseCache)
+    w.swrite(kind)
+    w.swrite(key)
+  do:
+    return err()
+  var enabled = false
+  var fd = cint(-1)
+  loader.withPacketReaderFire r:
+    r.sread(enabled)
+    if enabled:
+      var found: bool
+      r.sread(found)
+      if found:
+        fd = r.recvFd()
+  if not enabled:
+    return err()
+  if fd != -1:
+    return ok(newPosixStream(fd))
+  ok(nil)
+
+proc putParseCache*(loader: FileLoader; kind: ParseCacheKind; key: string;
+    data: openArray[char]) =
+  loader.withPacketWriterFire w:
+    w.swrite(lcPutParseCache)
+    w.swrite(kind)
+    w.swrite(key)
+    w.swrite(data)
+
+# Maximum total length of the keys and values in a Storage.
+const StorageQuota* = 5 * 1024 * 1024
+
+proc getStorage*(loader: FileLoader;
+    items: var seq[tuple[key, value: string]]): Opt[void] =
+  ## Read the persistent local storage of our origin.  Returns err() if the
+  ## loader does not persist storage for us.
+  loader.withPacketWriter w:
+    w.swrite(lcGetStorage)
+  do:
+    return err()
+  var enabled = false
+  loader.withPacketReaderFire r:
+    r.sread(enabled)
+    if enabled:
+      r.sread(items)
+  if not enabled:
+    return err()
+  ok()
+
+proc updateStorage*(loader: FileLoader; op: StorageOp; key, value: string) =
+  loader.withPacketWriterFire w:
+    w.swrite(lcUpdateStorage)
+    w.swrite(op)
+    w.swrite(key)
+    w.swrite(value)
+
 proc passFd*(loader: FileLoader; id: string; fd: cint) =
   loader.withPacketWriterFire w:
     w.swrite(lcPassFd)
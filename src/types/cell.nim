@@ -1,5 +1,6 @@
 import types/color
 import utils/strwidth
+import utils/twtstr
 
 type
   FormatFlag* = enum
@@ -26,17 +27,27 @@ type
 
   SimpleFlexibleGrid* = seq[SimpleFlexibleLine]
 
+  # Cells are plain 16-byte objects, so grids can be copied and compared
+  # without touching the heap.  Text of up to 7 bytes (i.e. nearly every
+  # cell: a code point, or a control char like ^A) is stored inline; longer
+  # text (e.g. with combining marks) lives in the grid's arena.
   FixedCell* = object
-    str*: string
     format*: Format
+    n: uint8 # length of inline text; LongText if the text is in the arena
+    s: array[7, char] # inline text, or the text's position in the arena
 
   FixedGrid* = object
     width*, height*: int
     cells*: seq[FixedCell]
+    arena: string # text of cells that do not fit inline
+    arenaLive: int # bytes of the arena still in use (approximately)
+
+const InlineTextLen = 7
+const LongText = uint8.high
+
+# Arena garbage we tolerate before compacting, on top of arenaLive.
+const ArenaSlack = 4096
 
-proc `[]=`*(grid: var FixedGrid; i: int; cell: FixedCell) = grid.cells[i] = cell
-proc `[]=`*(grid: var FixedGrid; i: BackwardsIndex; cell: FixedCell) =
-  grid.cells[i] = cell
 proc `[]`*(grid: var FixedGrid; i: int): var FixedCell = grid.cells[i]
 proc `[]`*(grid: var FixedGrid; i: BackwardsIndex): var FixedCell =
   grid.cells[i]
@@ -94,17 +105,117 @@ iterator items*(grid: FixedGrid): lent FixedCell {.inline.} =
   for cell in grid.cells:
     yield cell
 
-iterator mline*(grid: var FixedGrid; y: int; startx = 0): var FixedCell
-    {.inline.} =
-  let dls = y * grid.width
-  for cell in grid.cells.toOpenArray(dls + startx, dls + grid.width - 1).mitems:
-    yield cell
-
 proc newFixedGrid*(w, h: int): FixedGrid =
   return FixedGrid(width: w, height: h, cells: newSeq[FixedCell](w * h))
 
-proc width*(cell: FixedCell): int =
-  return cell.str.width()
+proc textPos(cell: FixedCell): tuple[off, len: int] =
+  var off: uint32
+  var len: uint16
+  copyMem(addr off, unsafeAddr cell.s[0], sizeof(off))
+  copyMem(addr len, unsafeAddr cell.s[4], sizeof(len))
+  return (int(off), int(len))
+
+proc setTextPos(cell: var FixedCell; off, len: int) =
+  var off = uint32(off)
+  var len = uint16(len)
+  cell.n = LongText
+  copyMem(addr cell.s[0], addr off, sizeof(off))
+  copyMem(addr cell.s[4], addr len, sizeof(len))
+
+proc textLen*(grid: FixedGrid; i: int): int =
+  let n = grid.cells[i].n
+  if n == LongText:
+    return grid.cells[i].textPos().len
+  return int(n)
+
+proc textPtr(grid: FixedGrid; i: int): ptr UncheckedArray[char] =
+  let cell = unsafeAddr grid.cells[i]
+  if cell.n == LongText:
+    let off = cell[].textPos().off
+    return cast[ptr UncheckedArray[char]](unsafeAddr grid.arena[off])
+  return cast[ptr UncheckedArray[char]](unsafeAddr cell.s[0])
+
+# The text of cell i as an openArray[char], without copying.  Only valid
+# until the next modification of the grid.
+template text*(grid: FixedGrid; i: int): untyped =
+  grid.textPtr(i).toOpenArray(0, grid.textLen(i) - 1)
+
+# Copy of the text of cell i.
+proc str*(grid: FixedGrid; i: int): string =
+  return grid.text(i).substr()
+
+proc compactArena(grid: var FixedGrid) =
+  var arena = newStringOfCap(grid.arenaLive)
+  for cell in grid.cells.mitems:
+    if cell.n == LongText:
+      let (off, len) = cell.textPos()
+      cell.setTextPos(arena.len, len)
+      arena.add(grid.arena.toOpenArray(off, off + len - 1))
+  grid.arena = move(arena)
+  grid.arenaLive = grid.arena.len
+
+proc setText*(grid: var FixedGrid; i: int; s: openArray[char]) =
+  let cell = addr grid.cells[i]
+  if cell.n == LongText:
+    grid.arenaLive -= cell[].textPos().len
+  # zero the unused bytes, so that sameText can compare inline cells as
+  # plain arrays.
+  cell.s = default(array[InlineTextLen, char])
+  if s.len <= InlineTextLen:
+    cell.n = uint8(s.len)
+    if s.len > 0:
+      copyMem(addr cell.s[0], unsafeAddr s[0], s.len)
+    return
+  cell.n = 0
+  if grid.arena.len > grid.arenaLive * 2 + ArenaSlack:
+    grid.compactArena()
+  let len = min(s.len, int(uint16.high))
+  cell[].setTextPos(grid.arena.len, len)
+  grid.arena.add(s.toOpenArray(0, len - 1))
+  grid.arenaLive += len
+
+proc setText*(grid: var FixedGrid; i: int; c: char) =
+  grid.setText(i, [c])
+
+proc addText*(grid: var FixedGrid; i: int; s: openArray[char]) =
+  if s.len == 0:
+    return
+  let n = grid.textLen(i)
+  if n + s.len <= InlineTextLen:
+    let cell = addr grid.cells[i]
+    copyMem(addr cell.s[n], unsafeAddr s[0], s.len)
+    cell.n = uint8(n + s.len)
+  else:
+    grid.setText(i, grid.str(i) & s.substr())
+
+proc clearText*(grid: var FixedGrid; i: int) =
+  grid.setText(i, "")
+
+# Reset cell i to an empty cell with the default format.
+proc clear*(grid: var FixedGrid; i: int) =
+  grid.clearText(i)
+  grid.cells[i].format = Format()
+
+# Move cell i to j, leaving an empty cell with the same format in i.
+proc moveCell*(grid: var FixedGrid; i, j: int) =
+  grid.clearText(j)
+  grid.cells[j] = grid.cells[i]
+  grid.cells[i].n = 0
+  grid.cells[i].s = default(array[InlineTextLen, char])
+
+proc sameText*(a: FixedGrid; i: int; b: FixedGrid; j: int): bool =
+  let ca = a.cells[i]
+  let cb = b.cells[j]
+  if ca.n != LongText and cb.n != LongText:
+    return ca.n == cb.n and ca.s == cb.s
+  return a.text(i) == b.text(j)
+
+# Whether cell i's text is exactly s.
+proc textIs*(grid: FixedGrid; i: int; s: openArray[char]): bool =
+  return grid.text(i) == s
+
+proc width*(grid: FixedGrid; i: int): int =
+  return grid.text(i).width()
 
 # Get the first format cell after pos, if any.
 proc findFormatN*(line: SimpleFlexibleLine; pos: int): int =
@@ -0,0 +1,75 @@
+# Timings and counters of the work a buffer does to display its document.
+#
+# Each buffer runs in its own process, so we just keep them in a global.
+# Style, tree, layout and render figures are of the last reshape (plus
+# whatever styling scripts triggered since the one before it); parse time,
+# bytes sent, allocation counts and the total* times are totals, and the
+# peak RSS is that of the whole process.
+
+{.push raises: [].}
+
+import std/monotimes
+import std/times
+
+type ReshapeStats* = object
+  reshapes*: int # number of reshapes so far
+  parseNs*: int64 # total time spent parsing HTML
+  bytesSent*: int # total size of line packets sent to the pager
+  styleNs*: int64 # cascade
+  treeNs*: int64 # box tree building, without the cascade it triggers
+  layoutNs*: int64
+  renderNs*: int64
+  styled*: int # elements styled
+  styleShared*: int # elements whose computed values were interned already
+  boxes*: int # block boxes visited by layout
+  boxesKept*: int # block boxes whose layout was kept from the last pass
+  lines*: int # lines rendered
+  atoms*: int # inline atoms allocated by layout
+  atomsReused*: int # inline atoms taken from layout's free list instead
+  frames*: int # tree frames built
+  framesReused*: int # tree frames that reused a finished frame's children
+  totalStyleNs*: int64 # styleNs etc. summed over all reshapes
+  totalTreeNs*: int64
+  totalLayoutNs*: int64
+  totalRenderNs*: int64
+  maxRss*: int # peak resident set size in KiB; filled in when queried
+
+var reshapeStats* = ReshapeStats()
+var styleDepth = 0
+
+# Return the nanoseconds elapsed since t, and set t to the current time.
+proc lap*(t: var MonoTime): int64 =
+  let now = getMonoTime()
+  result = (now - t).inNanoseconds
+  t = now
+
+# Time body as style work.  applyStyle may style ancestors first, so only
+# the outermost call is timed.
+template timeStyle*(body: untyped) =
+  inc styleDepth
+  var t = if styleDepth == 1: getMonoTime() else: MonoTime()
+  body
+  dec styleDepth
+  if styleDepth == 0:
+    reshapeStats.styleNs += t.lap()
+
+# Count a finished reshape and return the statistics as of its end.  The
+# figures of single reshapes start over for the next one.
+proc finishReshape*(stats: var ReshapeStats): ReshapeStats =
+  inc stats.reshapes
+  stats.totalStyleNs += stats.styleNs
+  stats.totalTreeNs += stats.treeNs
+  stats.totalLayoutNs += stats.layoutNs
+  stats.totalRenderNs += stats.renderNs
+  result = stats
+  stats.styleNs = 0
+  stats.treeNs = 0
+  stats.layoutNs = 0
+  stats.renderNs = 0
+  stats.styled = 0
+  stats.styleShared = 0
+  stats.boxes = 0
+  stats.boxesKept = 0
+  stats.lines = 0
+
+{.pop.} # raises: []
@@ -2,9 +2,7 @@
 
 import monoucha/libregexp
 import types/opt
-
-when NimMajor < 2:
-  from utils/twtstr import substr
+import utils/twtstr
 
 type
   Regex* = object
@@ -130,6 +128,135 @@ proc matchLast*[T: Regex|REBytecode](regex: T; str: openArray[char]; start = 0):
   var ctx = initContext(regex)
   ctx.matchLast(str, start)
 
+# Opcodes of libregexp-opcode.h, in the same order.
+type REOp = enum
+  reopInvalid, reopChar, reopCharI, reopChar32, reopChar32I, reopDot, reopAny,
+  reopSpace, reopNotSpace, reopLineStart, reopLineStartM, reopLineEnd,
+  reopLineEndM, reopGoto, reopSplitGotoFirst, reopSplitNextFirst, reopMatch,
+  reopLookaheadMatch, reopNegativeLookaheadMatch, reopSaveStart, reopSaveEnd,
+  reopSaveReset, reopLoop, reopLoopSplitGotoFirst, reopLoopSplitNextFirst,
+  reopLoopCheckAdvSplitGotoFirst, reopLoopCheckAdvSplitNextFirst, reopSetI32,
+  reopWordBoundary, reopWordBoundaryI, reopNotWordBoundary,
+  reopNotWordBoundaryI, reopBackReference, reopBackReferenceI,
+  reopBackwardBackReference, reopBackwardBackReferenceI, reopRange,
+  reopRangeI, reopRange32, reopRange32I
+
+const REHeaderLen = 8
+
+type RegexLiteral* = object
+  ## A string that every match of a regex contains.  If it is empty, the
+  ## regex has no such string (or we could not find it).
+  s*: string
+  ignoreCase*: bool # compare ASCII letters case-insensitively; s is lower case
+
+proc requiredLiteral*(bytecode: REBytecode): RegexLiteral =
+  ## Find the longest literal in the sequence of mandatory operations at the
+  ## start of the regex, which is where a plain string search (or the
+  ## literal part of e.g. `foo\d+`) ends up.  Stops at the first branch.
+  let p = cast[ptr UncheckedArray[uint8]](bytecode)
+  var blen: uint32
+  copyMem(addr blen, addr p[4], sizeof(blen))
+  let flags = lre_get_flags(cast[ptr uint8](bytecode)).toLREFlags()
+  let ignoreCase = LRE_FLAG_IGNORECASE in flags
+  let L = REHeaderLen + int(blen)
+  var i = REHeaderLen
+  if LRE_FLAG_STICKY notin flags:
+    i += 11 # skip the implicit .*? prefix: split_goto_first, any, goto
+  var best = ""
+  var cur = ""
+  while i < L:
+    let op = p[i]
+    if op > uint8(REOp.high):
+      break
+    var u = uint32.high
+    case REOp(op)
+    of reopChar, reopCharI:
+      var c: uint16
+      copyMem(addr c, addr p[i + 1], sizeof(c))
+      u = c
+      i += 3
+    of reopChar32, reopChar32I:
+      copyMem(addr u, addr p[i + 1], sizeof(u))
+      i += 5
+    of reopLineStart, reopLineStartM, reopLineEnd, reopLineEndM,
+        reopWordBoundary, reopWordBoundaryI, reopNotWordBoundary,
+        reopNotWordBoundaryI:
+      # zero-width; the literal goes on
+      inc i
+      continue
+    of reopSaveStart, reopSaveEnd:
+      i += 2
+      continue
+    of reopSaveReset:
+      i += 3
+      continue
+    of reopDot, reopAny, reopSpace, reopNotSpace:
+      inc i
+    of reopRange, reopRangeI, reopRange32, reopRange32I:
+      var n: uint16
+      copyMem(addr n, addr p[i + 1], sizeof(n))
+      let w = if REOp(op) in {reopRange, reopRangeI}: 4 else: 8
+      i += 3 + int(n) * w
+    else: # anything that branches, loops or looks around
+      break
+    let op2 = REOp(op)
+    if op2 in {reopChar, reopChar32} and u <= 0x10FFFF and
+        u notin 0xD800u32 .. 0xDFFFu32:
+      # case-sensitive even with the i flag, e.g. in (?-i:...); searching
+      # for it case-insensitively only lets more lines through
+      if ignoreCase and u < 0x80:
+        cur &= char(u).toLowerAscii()
+      else:
+        cur.addUTF8(u)
+      continue
+    # With the i flag, only ASCII characters that no other character folds
+    # to (unlike K and S, see KELVIN SIGN and LATIN SMALL LETTER LONG S)
+    # can be searched for as-is.  Without it, these come from a scoped
+    # (?i:...), and would need a case-insensitive search of their own.
+    if ignoreCase and op2 in {reopCharI, reopChar32I} and u < 0x80 and
+        char(u) notin {'k', 'K', 's', 'S'}:
+      cur &= char(u).toLowerAscii()
+      continue
+    if cur.len > best.len:
+      best = move(cur)
+    cur = ""
+  if cur.len > best.len:
+    best = move(cur)
+  RegexLiteral(s: move(best), ignoreCase: ignoreCase)
+
+proc requiredLiteral*(regex: Regex): RegexLiteral =
+  requiredLiteral(cast[REBytecode](unsafeAddr regex.bytecode[0]))
+
+proc findIgnoreCase(s: openArray[char]; needle: string): bool =
+  # Anchor the search on a byte without case variants if there is one,
+  # so that memchr does most of the work; otherwise search for both
+  # variants of the first byte.
+  let k = max(needle.find(AllChars - AsciiAlpha), 0)
+  let last = s.len - needle.len + k
+  if last < k:
+    return false
+  let lo = needle[k]
+  let up = lo.toUpperAscii()
+  var nl = s.find(lo, k, last)
+  var nu = if up != lo: s.find(up, k, last) else: -1
+  while nl >= 0 or nu >= 0:
+    let j = if nu < 0 or nl >= 0 and nl < nu: nl else: nu
+    if s.toOpenArray(j - k, j - k + needle.high).equalsIgnoreCase(needle):
+      return true
+    if j == nl:
+      nl = s.find(lo, j + 1, last)
+    else:
+      nu = s.find(up, j + 1, last)
+  false
+
+proc mayMatch*(literal: RegexLiteral; s: openArray[char]): bool =
+  ## False if s certainly has no match for the literal's regex.
+  if literal.s.len == 0:
+    return true
+  if literal.ignoreCase:
+    return s.findIgnoreCase(literal.s)
+  return s.find(literal.s) >= 0
+
 proc countBackslashes(buf: string; i: int): int =
   var j = 0
   for i in countdown(i, 0):
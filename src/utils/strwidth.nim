@@ -48,23 +48,23 @@ proc width*(u: uint32): int =
     return 2
   return 1
 
-proc width*(s: openArray[char]): int =
-  var w = 0
-  for u in s.points:
-    w += u.width()
-  return w
-
 proc width*(s: openArray[char]; start, len: int): int =
   var w = 0
   var i = start
-  var m = len
-  if m > s.len:
-    m = s.len
+  let m = min(len, s.len)
   while i < m:
-    let u = s.nextUTF8(i)
-    w += u.width()
+    # printable ASCII is always one cell wide
+    let j = s.toOpenArray(0, m - 1).skipAsciiPrint(i)
+    w += j - i
+    i = j
+    if i < m:
+      let u = s.nextUTF8(i)
+      w += u.width()
   return w
 
+proc width*(s: openArray[char]): int =
+  return s.width(0, s.len)
+
 # Expand all PUA tabs into hard tabs, disregarding their position.
 # (This is mainly intended for copy/paste, where the actual characters
 # are more interesting than cell alignment.)
@@ -468,6 +468,45 @@ proc contains*(s1: openArray[char]; s2: string): bool =
 proc contains*(s: openArray[char]; cs: set[char]): bool =
   s.find(cs) != -1
 
+# Word-at-a-time scanning: test eight bytes at once for the ones we stop
+# at, and only look at them one by one in the word that has them.
+const LowBits = 0x0101010101010101'u64
+const HighBits = 0x8080808080808080'u64
+
+proc loadWord(s: openArray[char]; i: int): uint64 {.inline.} =
+  copyMem(addr result, unsafeAddr s[i], sizeof(result))
+
+# Bytes under n, DEL and non-ASCII bytes get their high bit set.  (Borrows
+# and carries may mark other bytes too, but only in words that do have
+# such a byte.)
+template notPrintable(x: uint64; n: char): uint64 =
+  x or (x + LowBits) or ((x - LowBits * uint64(n)) and not x)
+
+# Return the index of the first byte in s at or after i that is not
+# printable ASCII (i.e. not in ' '..'~'), or s.len if there is none.
+proc skipAsciiPrint*(s: openArray[char]; i: int): int =
+  var i = i
+  while i + 8 <= s.len and (s.loadWord(i).notPrintable(' ') and HighBits) == 0:
+    i += 8
+  while i < s.len and s[i] in {' '..'~'}:
+    inc i
+  i
+
+# Like skipAsciiPrint, but also stop at space and hyphen-minus; i.e. skip
+# the bytes that are one cell wide and never a break opportunity.
+proc skipAsciiWord*(s: openArray[char]; i: int): int =
+  const Dash = LowBits * uint64('-')
+  var i = i
+  while i + 8 <= s.len:
+    let x = s.loadWord(i)
+    let y = x xor Dash
+    if ((x.notPrintable('!') or ((y - LowBits) and not y)) and HighBits) != 0:
+      break
+    i += 8
+  while i < s.len and s[i] in {'!'..'~'} - {'-'}:
+    inc i
+  i
+
 proc onlyWhitespace*(s: openArray[char]): bool =
   AllChars - AsciiWhitespace notin s
 
@@ -757,25 +796,42 @@ type EscapeMode* = enum
   emAttribute # text chars plus double quote ("attribute mode" in spec)
   emText # &, nbsp, <, > (default mode in spec)
 
+# Append s to res, escaped.  Runs of characters that need no escaping are
+# copied in one go, so mostly plain text costs little more than a copy.
+proc htmlEscape*(res: var string; s: openArray[char]; mode = emAll) =
+  const TextChars = {'<', '>', '&', '\xC2'}
+  const Special = [
+    emAll: TextChars + {'"', '\''},
+    emAttribute: TextChars + {'"'},
+    emText: TextChars
+  ]
+  let special = Special[mode]
+  var i = 0
+  while i < s.len:
+    var j = i
+    while j < s.len and s[j] notin special:
+      inc j
+    if j > i:
+      res.add(s.toOpenArray(i, j - 1))
+    if j >= s.len:
+      break
+    case s[j]
+    of '<': res &= "&lt;"
+    of '>': res &= "&gt;"
+    of '&': res &= "&amp;"
+    of '"': res &= "&quot;"
+    of '\'': res &= "&apos;"
+    else: # \xC2
+      if j + 1 < s.len and s[j + 1] == '\xA0':
+        res &= "&nbsp;"
+        inc j
+      else:
+        res &= '\xC2'
+    i = j + 1
+
 proc htmlEscape*(s: openArray[char]; mode = emAll): string =
   result = newStringOfCap(s.len)
-  var nbspMode = false
-  for c in s:
-    if nbspMode:
-      if c == '\xA0':
-        result &= "&nbsp;"
-      else:
-        result &= '\xC2' & c
-      nbspMode = false
-      continue
-    case c
-    of '<': result &= "&lt;"
-    of '>': result &= "&gt;"
-    of '&': result &= "&amp;"
-    of '\xC2': nbspMode = true
-    elif c == '"' and mode <= emAttribute: result &= "&quot;"
-    elif c == '\'' and mode == emAll: result &= "&apos;"
-    else: result &= c
+  result.htmlEscape(s, mode)
 
 proc dqEscape*(s: openArray[char]): string =
   result = newStringOfCap(s.len)
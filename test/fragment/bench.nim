@@ -0,0 +1,71 @@
+# Times innerHTML's fast path against the full fragment parser, and
+# serialization.
+import std/envvars
+import std/math
+import std/monotimes
+import std/strutils
+import std/times
+
+import chame/tags
+import html/catom
+import html/chadombuilder
+import html/dom
+import types/url
+
+proc generate(n: int): string =
+  result = "<ul class=\"list\">"
+  for i in 0 ..< n:
+    result &= "<li class=\"item\" data-id=" & $i & "><span class=name>Item " &
+      $i & " &amp; co</span> <b>new</b><br><a href=\"/item/" & $i &
+      "\" title='Open item'>open</a></li>\n"
+  result &= "</ul>"
+
+proc time(iter: int; body: proc()): float64 =
+  let start = getMonoTime()
+  for i in 0 ..< iter:
+    body()
+  return (getMonoTime() - start).inNanoseconds.float64 / 1e6 / float64(iter)
+
+proc serialize(document: Document; nodes: seq[Node]): string =
+  let div0 = document.newHTMLElement(ttDiv)
+  for node in nodes:
+    div0.insert(node, nil, nil)
+  div0.serializeFragment(writeShadow = false)
+
+proc main() =
+  let n = parseInt(getEnv("BENCH_ITEMS", "200"))
+  let iter = parseInt(getEnv("BENCH_ITER", "1000"))
+  initCAtomFactory()
+  let document = newDocument(parseURL0("about:blank"))
+  document.contentType = satTextHtml
+  let ctx = document.newHTMLElement(ttDiv)
+  let markup = generate(n)
+  var fast: seq[Node] = @[]
+  if not ctx.parseHTMLFragmentFast(markup, fast):
+    echo "ERROR: fast path rejected the generated markup"
+    quit(1)
+  let full = ctx.parseHTMLFragmentFull(markup)
+  let s = document.serialize(fast)
+  if s != document.serialize(full):
+    echo "ERROR: fast path and full parser trees differ"
+    quit(1)
+  let table = "<table>" & markup & "</table>"
+  echo "Markup: ", markup.len, " bytes, ", n, " items, ", iter, " iterations"
+  let fastTime = time(iter, proc() =
+    var nodes: seq[Node] = @[]
+    discard ctx.parseHTMLFragmentFast(markup, nodes))
+  let fullTime = time(iter, proc() =
+    discard ctx.parseHTMLFragmentFull(markup))
+  let fallbackTime = time(iter, proc() =
+    discard ctx.parseHTMLFragment(table))
+  let div0 = document.newHTMLElement(ttDiv)
+  for node in ctx.parseHTMLFragmentFull(markup):
+    div0.insert(node, nil, nil)
+  let serializeTime = time(iter, proc() =
+    discard div0.serializeFragment(writeShadow = false))
+  echo "parse (fast path): ", fastTime.round(3), "ms"
+  echo "parse (full parser): ", fullTime.round(3), "ms"
+  echo "parse (fallback, <table>): ", fallbackTime.round(3), "ms"
+  echo "serialize: ", serializeTime.round(3), "ms (", s.len, " bytes)"
+
+main()
@@ -0,0 +1,256 @@
+# Times cha laying out generated documents and the layout test corpus,
+# and reports regressions against a saved baseline.
+import std/algorithm
+import std/envvars
+import std/json
+import std/math
+import std/monotimes
+import std/os
+import std/posix
+import std/strutils
+import std/tables
+import std/tempfiles
+import std/times
+
+proc wait4(pid: Pid; status: var cint; options: cint; usage: ptr Rusage): Pid
+  {.importc, header: "<sys/wait.h>".}
+
+type
+  Metric = tuple[name: string; value: float64]
+
+  Case = object
+    name: string
+    files: seq[string]
+
+# Phases of the reshape statistics, and the keys of their totals.
+const Phases = {
+  "parse": "parseNs",
+  "style": "totalStyleNs",
+  "tree": "totalTreeNs",
+  "layout": "totalLayoutNs",
+  "render": "totalRenderNs"
+}
+
+# Allocation counters of the reshape statistics, and their keys.  Without
+# the free lists of layout and csstree, allocs + reused objects would have
+# been allocated.
+const Allocs = {
+  "atom-allocs": "atoms",
+  "atom-reused": "atomsReused",
+  "frame-allocs": "frames",
+  "frame-reused": "framesReused"
+}
+
+proc genTable(n: int): string =
+  result = "<!DOCTYPE html>\n<table border=1>\n<tr>"
+  for j in 0 ..< 10:
+    result &= "<th>Column " & $j
+  for i in 0 ..< n:
+    result &= "\n<tr>"
+    for j in 0 ..< 10:
+      result &= "<td>"
+      if j mod 3 == 0:
+        result &= "Row " & $i & " has a somewhat longer cell"
+      else:
+        result &= $(i * 10 + j)
+  result &= "\n</table>\n"
+
+proc genNesting(n: int): string =
+  result = "<!DOCTYPE html>\n<style>.d0 { margin-top: 1em }" &
+    " .d1 { color: navy } .d2 { font-weight: bold }" &
+    " .d3 { text-indent: 1ch }</style>\n"
+  for i in 0 ..< n:
+    result &= "<div class=d" & $(i mod 4) & ">level " & $i &
+      " <span><em>text</em></span>\n"
+  for i in 0 ..< n:
+    result &= "</div>"
+  result &= '\n'
+
+proc genList(n: int): string =
+  result = "<!DOCTYPE html>\n<ol>\n"
+  for i in 0 ..< n:
+    result &= "<li>Item " & $i & " <a href=\"#i" & $i & "\">link</a>" &
+      " <b>bold</b> and some text that wraps around the end of the line"
+    if i mod 100 == 99:
+      result &= "<ul><li>nested<li>list</ul>"
+    result &= '\n'
+  result &= "</ol>\n"
+
+proc genFlex(n: int): string =
+  result = "<!DOCTYPE html>\n<style>.r { display: flex; flex-wrap: wrap }" &
+    " .c { display: flex; flex-direction: column }" &
+    " .i { flex: 1 1 12ch } .g { flex-grow: 2 }</style>\n"
+  for i in 0 ..< n:
+    result &= "<div class=" & (if i mod 5 == 4: "c" else: "r") & ">"
+    for j in 0 ..< 6:
+      result &= "<div class=\"i" & (if j == 2: " g" else: "") & "\">item " &
+        $i & "." & $j & "</div>"
+    result &= "</div>\n"
+
+proc genPre(n: int): string =
+  result = "<!DOCTYPE html>\n<pre>\n"
+  for i in 0 ..< n:
+    result &= $i & "\tpreformatted text that runs past the right edge of" &
+      " the window, with &lt;markup&gt; and\ttabs " & '-'.repeat(i mod 40) &
+      '\n'
+  result &= "</pre>\n"
+
+proc generate(dir, name, s: string): Case =
+  let path = dir / name & ".html"
+  writeFile(path, s)
+  Case(name: name, files: @[path])
+
+proc maxRss(usage: Rusage): float64 =
+  when defined(macosx): # bytes, not KiB
+    float64(usage.ru_maxrss) / 1024
+  else:
+    float64(usage.ru_maxrss)
+
+proc run(cha, config, errPath: string; files: seq[string]): seq[Metric] =
+  let start = getMonoTime()
+  let pid = fork()
+  if pid == 0:
+    let null = open("/dev/null", O_WRONLY)
+    let err = open(cstring(errPath), O_WRONLY or O_CREAT or O_TRUNC,
+      Mode(0o644))
+    if null < 0 or err < 0:
+      quit(127)
+    discard dup2(null, 1)
+    discard dup2(err, 2)
+    let argv = allocCStringArray(@[cha, "-C", config, "-o",
+      "start.reshape-stats=true"] & files)
+    discard execvp(cstring(cha), argv)
+    quit(127)
+  var status: cint
+  var usage: Rusage
+  if wait4(pid, status, 0, addr usage) < 0 or not WIFEXITED(status) or
+      WEXITSTATUS(status) != 0:
+    echo "ERROR: cha failed on ", files.join(" ")
+    stdout.write(readFile(errPath))
+    quit(1)
+  let wall = (getMonoTime() - start).inNanoseconds.float64 / 1e6
+  var phases = newSeq[float64](Phases.len)
+  var allocs = newSeq[float64](Allocs.len)
+  var bufferRss = 0f64
+  var buffers = 0
+  for line in lines(errPath):
+    if not line.startsWith('{'):
+      continue
+    var stats: JsonNode
+    try:
+      stats = parseJson(line)
+    except CatchableError:
+      continue
+    for i, it in Phases:
+      phases[i] += stats{it[1]}.getFloat() / 1e6
+    for i, it in Allocs:
+      allocs[i] += stats{it[1]}.getFloat()
+    bufferRss = max(bufferRss, stats{"maxRss"}.getFloat())
+    inc buffers
+  if buffers != files.len:
+    echo "ERROR: expected statistics of ", files.len, " buffers, got ",
+      buffers
+    quit(1)
+  result = @[("wall", wall), ("rss", usage.maxRss()),
+    ("buffer-rss", bufferRss)]
+  for i, it in Phases:
+    result.add((it[0], phases[i]))
+  for i, it in Allocs:
+    result.add((it[0], allocs[i]))
+
+proc isRss(m: Metric): bool =
+  m.name.endsWith("rss")
+
+proc isCount(m: Metric): bool =
+  m.name.endsWith("allocs") or m.name.endsWith("reused")
+
+proc `$`(m: Metric): string =
+  if m.isRss():
+    $(m.value / 1024).round(1) & "M"
+  elif m.isCount():
+    $int64(m.value)
+  else:
+    $m.value.round(1) & "ms"
+
+proc readBaseline(path: string): Table[string, float64] =
+  result = initTable[string, float64]()
+  for line in lines(path):
+    let fields = line.splitWhitespace()
+    if fields.len == 3 and not line.startsWith('#'):
+      result[fields[0] & ' ' & fields[1]] = parseFloat(fields[2])
+
+proc main() =
+  let cha = getEnv("CHA", "./cha")
+  let config = getEnv("BENCH_CONFIG", "test/layout/config.toml")
+  let scale = parseFloat(getEnv("BENCH_SCALE", "1"))
+  let iter = parseInt(getEnv("BENCH_ITER", "3"))
+  # baselines are specific to the machine, so keep them with the build
+  let baselinePath = getEnv("BENCH_BASELINE",
+    getEnv("OBJDIR", ".obj") / "layout-bench.baseline")
+  let save = getEnv("BENCH_SAVE") == "1"
+  let tolerance = parseFloat(getEnv("BENCH_TOLERANCE", "20")) / 100
+  let size = proc(n: int): int = max(int(float64(n) * scale), 1)
+  let dir = createTempDir("chabench", "")
+  var cases = @[
+    dir.generate("table", genTable(size(2000))),
+    dir.generate("nesting", genNesting(size(500))),
+    dir.generate("list", genList(size(10000))),
+    dir.generate("flex", genFlex(size(1000))),
+    dir.generate("pre", genPre(size(20000)))
+  ]
+  var corpus: seq[string] = @[]
+  for path in walkFiles("test/layout/*.html"):
+    corpus.add(path)
+  corpus.sort()
+  if corpus.len > 0:
+    cases.add(Case(name: "corpus", files: corpus))
+  let errPath = dir / "stderr"
+  var results: seq[(string, seq[Metric])] = @[]
+  for it in cases:
+    var best: seq[Metric] = @[]
+    for i in 0 ..< iter:
+      let metrics = run(cha, config, errPath, it.files)
+      if best.len == 0:
+        best = metrics
+      else:
+        for j, m in metrics:
+          best[j].value = min(best[j].value, m.value)
+    var s = it.name & ":"
+    for m in best:
+      s &= ' ' & m.name & ' ' & $m
+    echo s
+    results.add((it.name, best))
+  removeDir(dir)
+  if save:
+    var s = "# case metric value (ms, KiB or count)\n"
+    for (name, metrics) in results:
+      for m in metrics:
+        s &= name & ' ' & m.name & ' ' & $m.value.round(3) & '\n'
+    if baselinePath.parentDir() != "":
+      createDir(baselinePath.parentDir())
+    writeFile(baselinePath, s)
+    echo "Baseline written to ", baselinePath
+    return
+  if not fileExists(baselinePath):
+    echo "No baseline at ", baselinePath, "; run with BENCH_SAVE=1 first"
+    return
+  let baseline = readBaseline(baselinePath)
+  var regressions = 0
+  for (name, metrics) in results:
+    for m in metrics:
+      let base = baseline.getOrDefault(name & ' ' & m.name, -1)
+      if base < 0 or m.name.endsWith("reused"): # more reuse is no regression
+        continue
+      # ignore noise in figures too small to matter
+      let floor = if m.isRss(): 1024f64 else: 1f64
+      if m.value > base * (1 + tolerance) and m.value - base > floor:
+        let old: Metric = (m.name, base)
+        let percent = (m.value / max(base, 1e-3) - 1) * 100
+        echo "REGRESSION: ", name, ' ', m.name, ": ", old, " -> ", m, " (+",
+          percent.round(1), "%)"
+        inc regressions
+  if regressions > 0:
+    quit(1)
+  echo "No regressions (tolerance ", (tolerance * 100).round(1), "%)"
+
+main()
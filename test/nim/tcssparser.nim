@@ -0,0 +1,39 @@
+import std/strutils
+
+import css/cssparser
+import html/catom
+
+proc tokenize(s: string): seq[CSSToken] =
+  var ctx = initCSSParser(s)
+  while ctx.has():
+    discard ctx.consume()
+  move(ctx.toks)
+
+proc testSerializeTokens() =
+  initCAtomFactory()
+  let toks = tokenize("""
+@media (min-width: 10em) { a[href^="x"]:hover > b.c#d { color: #abc } }
+@import url(x.css) layer(l);
+p::before { content: "\"q\""; width: calc(100% - -1.5e3px); z-index: -2 }
+x { --v: 12 dppx; u: U+26; } <!-- --> \E9 té """ & "x".repeat(200))
+  var data = ""
+  data.serializeTokens(toks)
+  var toks2: seq[CSSToken] = @[]
+  assert data.deserializeTokens(toks2)
+  assert toks.len == toks2.len
+  for i, tok in toks:
+    let tok2 = toks2[i]
+    assert tok.t == tok2.t and tok.flags == tok2.flags and tok.dt == tok2.dt
+    assert tok.s == tok2.s
+    assert $tok == $tok2
+    if tok.t in {cttNumber, cttPercentage, cttDimension}:
+      assert tok.num == tok2.num
+  # truncated input is rejected
+  for i in 1 ..< data.len:
+    var toks3: seq[CSSToken] = @[]
+    if data.toOpenArray(0, i - 1).deserializeTokens(toks3):
+      assert toks3.len < toks.len
+  var toks4: seq[CSSToken] = @[]
+  assert not "\xFF\x00\x00\x00".deserializeTokens(toks4)
+
+testSerializeTokens()
@@ -0,0 +1,39 @@
+import monoucha/libregexp
+import utils/lrewrap
+
+proc compile(s: string; flags: LREFlags = {}): Regex =
+  var regex: Regex
+  assert compileRegex(s, flags, regex), regex.bytecode
+  move(regex)
+
+# Lines the prefilter lets through must include every line the regex
+# matches.
+proc check(regex: Regex; lines: openArray[string]) =
+  let literal = regex.requiredLiteral()
+  for s in lines:
+    if regex.matchFirst(s).s >= 0:
+      assert literal.mayMatch(s), s
+
+proc testScopedIgnoreCase() =
+  let lines = ["xFOObar", "xfoobar", "xFoObar", "XFOOBAR", "xfoo"]
+  let regex = compile("x(?i:foo)bar")
+  regex.check(lines)
+  assert regex.requiredLiteral().s.len <= 3 # "bar" or "x"
+  assert regex.matchFirst("a xFOObar").s == 2
+  # and the other way around
+  let regex2 = compile("a(?-i:B)c", {LRE_FLAG_IGNORECASE})
+  regex2.check(["aBc", "ABC", "abc", "AbC"])
+  assert regex2.requiredLiteral().mayMatch("ABC")
+
+proc testLiteral() =
+  let regex = compile("zygote\\d+")
+  let literal = regex.requiredLiteral()
+  assert literal.s == "zygote"
+  assert not literal.ignoreCase
+  assert literal.mayMatch("user=1 zygote")
+  assert not literal.mayMatch("user=1 ZYGOTE")
+  let regex2 = compile("zygote", {LRE_FLAG_IGNORECASE})
+  assert regex2.requiredLiteral().mayMatch("user=1 ZYGOTE")
+
+testScopedIgnoreCase()
+testLiteral()
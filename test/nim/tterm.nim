@@ -0,0 +1,89 @@
+import std/strutils
+
+import local/term
+import types/cell
+
+type Screen = object
+  lines: seq[string]
+  x, y: int
+
+proc initScreen(w, h: int): Screen =
+  result = Screen(lines: newSeq[string](h))
+  for line in result.lines.mitems:
+    line = ' '.repeat(w)
+
+# Apply the output of testDraw to the screen.  Only what drawing emits is
+# understood: text, CR, LF, CUP, CUF, EL, ED and ignored modes.
+proc replay(screen: var Screen; s: string) =
+  var i = 0
+  while i < s.len:
+    let c = s[i]
+    inc i
+    case c
+    of '\r': screen.x = 0
+    of '\n': inc screen.y
+    of '\e':
+      assert s[i] == '['
+      inc i
+      var params = ""
+      while s[i] in {'0'..'9', ';', '?'}:
+        params &= s[i]
+        inc i
+      let f = s[i]
+      inc i
+      case f
+      of 'H':
+        if params == "":
+          screen.x = 0
+          screen.y = 0
+        else:
+          let p = params.split(';')
+          screen.y = parseInt(p[0]) - 1
+          screen.x = parseInt(p[1]) - 1
+      of 'C':
+        screen.x += (if params == "": 1 else: parseInt(params))
+      of 'K':
+        for x in screen.x ..< screen.lines[screen.y].len:
+          screen.lines[screen.y][x] = ' '
+      of 'J':
+        for y in screen.y ..< screen.lines.len:
+          let sx = if y == screen.y: screen.x else: 0
+          for x in sx ..< screen.lines[y].len:
+            screen.lines[y][x] = ' '
+      of 'r': # DECSTBM homes the cursor
+        screen.x = 0
+        screen.y = 0
+      of 'm', 'h', 'l': discard
+      else: assert false, "unexpected sequence " & params & f
+    else:
+      screen.lines[screen.y][screen.x] = c
+      inc screen.x
+
+proc setLine(grid: var FixedGrid; y: int; cells: openArray[string]) =
+  for x, s in cells:
+    grid.setText(y * grid.width + x, s)
+
+# Clearing a cell in the middle of a line must erase what the terminal
+# shows there, whether the rest of the line is clean (line 0) or the next
+# damaged cell is far enough to skip to (line 1).
+proc testClearCell() =
+  let term = newTerminal(nil, nil, nil)
+  term.testInit(20, 2)
+  var screen = initScreen(20, 2)
+  var grid = newFixedGrid(20, 2)
+  grid.setLine(0, ["a", "X", "b", "c", "d", "e", "f"])
+  grid.setLine(1, ["a", "X", "b", "c", "d", "e", "f", "g", "h", "i", "j",
+    "k", "l", "m", "n", "Y"])
+  term.writeGrid(grid)
+  screen.replay(term.testDraw())
+  assert screen.lines[0] == "aXbcdef             "
+  assert screen.lines[1] == "aXbcdefghijklmnY    "
+  grid.setText(1, "")
+  grid.setText(20 + 1, "")
+  grid.setText(20 + 15, "Z")
+  term.writeGrid(grid)
+  screen.replay(term.testDraw())
+  assert screen.lines[0] == "a bcdef             ", screen.lines[0]
+  assert screen.lines[1] == "a bcdefghijklmnZ    ", screen.lines[1]
+
+testClearCell()
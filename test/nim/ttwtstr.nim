@@ -72,6 +72,23 @@ proc testReplaceSurrogates() =
   s.replaceSurrogates()
   assert s == "abcd"
 
+proc testSkipAscii() =
+  assert "".skipAsciiPrint(0) == 0
+  assert "abc".skipAsciiPrint(0) == 3
+  assert "abc".skipAsciiPrint(3) == 3
+  assert "abcdefgh ijklmn\topq".skipAsciiPrint(0) == 15
+  assert "abcdefgh\x7Fijk".skipAsciiPrint(0) == 8
+  assert "abcdefghijk\u00E9".skipAsciiPrint(2) == 11
+  assert "\u00E9abcdefghijklmnop".skipAsciiPrint(0) == 0
+  assert "abcdefghijklmnop\xFF".skipAsciiPrint(1) == 16
+  assert "abcdefghijklmnop-qr".skipAsciiWord(0) == 16
+  assert "abcdefgh ijklmnop".skipAsciiWord(0) == 8
+  assert "abcdefghijklmnop qr".skipAsciiWord(3) == 16
+  assert "a-".skipAsciiWord(0) == 1
+  assert "abcdefgh\nij".skipAsciiWord(0) == 8
+  assert "abcdefghijklmnopqrstu\u3042".skipAsciiWord(0) == 21
+  assert "\xFFabcdefghijklmnop".skipAsciiWord(1) == 17
+
 proc run() =
   testFind()
   testStrip()
@@ -83,3 +100,4 @@ static:
 
 run()
 testReplaceSurrogates()
+testSkipAscii()
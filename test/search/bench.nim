@@ -0,0 +1,81 @@
+# Times in-buffer regex search over generated lines, with and without the
+# literal prefilter.
+import std/envvars
+import std/math
+import std/strutils
+import std/times
+
+import monoucha/libregexp
+import utils/lrewrap
+
+const DefaultPatterns = [
+  "zygote", # rare literal
+  "request", # common literal
+  "ZYGOTE", # literal, searched case-insensitively (see below)
+  "user=\\d+ zygote", # literal, then a repetition
+  "id=[0-9a-f]{8}", # mostly literal
+  "\\bfail(ed|ure)\\b", # literal prefix, then a branch
+  "[A-Z]{3}\\d", # no literal
+]
+
+const Words = ["request", "served", "cache", "miss", "hit", "error",
+  "timeout", "retry", "worker", "queue", "session", "token"]
+
+proc generate(n: int): seq[string] =
+  result = newSeq[string](n)
+  var seed = 12345u32
+  proc next(seed: var uint32): int =
+    seed = seed * 1103515245u32 + 12345u32
+    int(seed shr 16)
+  for i in 0 ..< n:
+    var s = "2024-01-01T00:00:" & $(i mod 60) & " user=" & $seed.next()
+    for j in 0 ..< 8 + seed.next() mod 8:
+      s &= ' ' & Words[seed.next() mod Words.len]
+    s &= " id=" & toHex(seed.next(), 8).toLowerAscii()
+    if i mod 100000 == 77777:
+      s &= " zygote"
+    if i mod 5000 == 0:
+      s &= " failed"
+    result[i] = s
+
+proc search(regex: Regex; lines: seq[string]; prefilter: bool): int =
+  let literal = if prefilter: regex.requiredLiteral() else: RegexLiteral()
+  result = 0
+  for s in lines:
+    if literal.mayMatch(s) and regex.matchFirst(s).s >= 0:
+      inc result
+
+proc main() =
+  let n = parseInt(getEnv("BENCH_LINES", "500000"))
+  let iter = parseInt(getEnv("BENCH_ITER", "5"))
+  var patterns = @DefaultPatterns
+  if existsEnv("BENCH_PATTERNS"):
+    patterns = getEnv("BENCH_PATTERNS").split('\n')
+  let lines = generate(n)
+  echo "Searching ", n, " lines, ", iter, " iterations"
+  for pattern in patterns:
+    var flags = {LRE_FLAG_GLOBAL, LRE_FLAG_UNICODE}
+    if pattern.toLowerAscii() != pattern and pattern.toUpperAscii() == pattern:
+      flags.incl(LRE_FLAG_IGNORECASE)
+    var regex: Regex
+    if not compileRegex(pattern, flags, regex):
+      echo "ERROR: failed to compile ", pattern, ": ", regex.bytecode
+      quit(1)
+    let literal = regex.requiredLiteral()
+    var times: array[bool, float64]
+    var counts: array[bool, int]
+    for prefilter in [false, true]:
+      let start = cpuTime()
+      for i in 0 ..< iter:
+        counts[prefilter] = regex.search(lines, prefilter)
+      times[prefilter] = (cpuTime() - start) / float64(iter)
+    if counts[false] != counts[true]:
+      echo "ERROR: ", pattern, ": prefilter found ", counts[true],
+        " lines instead of ", counts[false]
+      quit(1)
+    echo pattern, " (literal ", escape(literal.s),
+      (if literal.ignoreCase: ", ignore case" else: ""), "): ",
+      counts[true], " lines, regex only ", (times[false] * 1000).round(3),
+      "ms, prefiltered ", (times[true] * 1000).round(3), "ms"
+
+main()
@@ -0,0 +1,61 @@
+# Times forking a process and setting up a scripting window in it, from a
+# cold process and from one that already has a template window.
+import std/envvars
+import std/math
+import std/monotimes
+import std/posix
+import std/strutils
+import std/times
+
+import config/conftypes
+import html/dom
+import html/env
+import types/url
+import types/winattrs
+
+type SpawnKind = enum
+  skFork = "fork only"
+  skCold = "cold window"
+  skTemplate = "from template"
+
+var attrs = WindowAttributes(width: 80, height: 24, ppc: 9, ppl: 18)
+
+proc initWindow(prewarmed: Window) =
+  let window = newWindow(smTrue, false, true, false, hmFalse, addr attrs,
+    nil, parseURL0("about:blank"), nil, @[], "", "", "text/html", prewarmed)
+  if window.jsctx == nil:
+    quit(1)
+
+proc spawn(kind: SpawnKind; prewarmed: Window): float64 =
+  let start = getMonoTime()
+  let pid = fork()
+  if pid == 0:
+    case kind
+    of skFork: discard
+    of skCold: initWindow(nil)
+    of skTemplate: initWindow(prewarmed)
+    exitnow(0)
+  var status: cint
+  discard waitpid(pid, status, 0)
+  if not WIFEXITED(status) or WEXITSTATUS(status) != 0:
+    echo "ERROR: child failed: ", kind
+    quit(1)
+  return (getMonoTime() - start).inNanoseconds.float64 / 1e6
+
+proc main() =
+  let iter = parseInt(getEnv("BENCH_ITER", "50"))
+  let prewarmed = newScriptingWindow()
+  echo "Spawning ", iter, " processes per kind"
+  for kind in SpawnKind:
+    var total = 0f64
+    var low = float64.high
+    var high = 0f64
+    for i in 0 ..< iter:
+      let time = spawn(kind, prewarmed)
+      total += time
+      low = min(low, time)
+      high = max(high, time)
+    echo kind, ": avg ", (total / float64(iter)).round(3), "ms lowest ",
+      low.round(3), "ms highest ", high.round(3), "ms"
+
+main()
@@ -0,0 +1,152 @@
+# Replays a session of keystrokes in cha running in a pseudo-terminal, and
+# reports the bytes written and the time taken per frame.
+import std/envvars
+import std/math
+import std/monotimes
+import std/posix
+import std/strutils
+import std/termios
+import std/times
+
+{.push importc, header: "<stdlib.h>".}
+proc posix_openpt(flags: cint): cint
+proc grantpt(fd: cint): cint
+proc unlockpt(fd: cint): cint
+proc ptsname(fd: cint): cstring
+{.pop.}
+
+const IdleMs = 50 # consider the frame done after this much silence
+
+type Frame = object
+  keys: string
+  count: int
+
+proc unescape(s: string): string =
+  result = ""
+  var i = 0
+  while i < s.len:
+    let c = s[i]
+    inc i
+    if c != '\\' or i >= s.len:
+      result &= c
+      continue
+    let e = s[i]
+    inc i
+    case e
+    of 'e': result &= '\e'
+    of 't': result &= '\t'
+    of 'r': result &= '\r'
+    of 'n': result &= '\n'
+    of 'x':
+      result &= char(parseHexInt(s.substr(i, i + 1)))
+      i += 2
+    else: result &= e
+
+# One frame per line: the keys to send, with \e, \t, \r, \n, \\ and
+# \xHH escapes, optionally preceded by a repeat count ("40 \x05").  Lines
+# starting with # are ignored.
+proc parseSession(path: string): seq[Frame] =
+  result = @[]
+  for line in lines(path):
+    if line.len == 0 or line[0] == '#':
+      continue
+    var count = 1
+    var keys = line
+    let i = line.find(' ')
+    if i > 0 and line.substr(0, i - 1).allCharsInSet(Digits):
+      count = parseInt(line.substr(0, i - 1))
+      keys = line.substr(i + 1)
+    result.add(Frame(keys: keys.unescape(), count: count))
+
+type Output = object
+  master: cint
+  bytes: int
+  last: MonoTime
+  tail: string # end of the previous read, for finding queries
+
+# Read output until the terminal is idle for IdleMs.  Queries are answered
+# with DA1 only, which cha treats as the end of the query list.
+proc drain(output: var Output) =
+  var buf = newString(4096)
+  var pfd = TPollfd(fd: output.master, events: POLLIN)
+  while poll(addr pfd, 1, IdleMs) > 0:
+    let n = read(output.master, addr buf[0], buf.len)
+    if n <= 0:
+      break
+    output.bytes += n
+    output.last = getMonoTime()
+    output.tail &= buf.substr(0, n - 1)
+    if "\e[c" in output.tail:
+      const DA1 = "\e[?1;22c"
+      discard write(output.master, cstring(DA1), DA1.len)
+    output.tail = output.tail.substr(max(output.tail.len - 2, 0))
+
+proc spawn(cha, config, file, term: string; cols, lines: int): (cint, Pid) =
+  let master = posix_openpt(O_RDWR or O_NOCTTY)
+  if master < 0 or grantpt(master) != 0 or unlockpt(master) != 0:
+    stderr.writeLine("failed to open pty")
+    quit(1)
+  var ws = IOctl_WinSize(ws_row: uint16(lines), ws_col: uint16(cols))
+  discard ioctl(master, TIOCSWINSZ, addr ws)
+  let slaveName = $ptsname(master)
+  let pid = fork()
+  if pid == 0:
+    discard setsid()
+    let slave = open(cstring(slaveName), O_RDWR) # becomes controlling tty
+    if slave < 0:
+      quit(127)
+    for fd in 0.cint .. 2.cint:
+      discard dup2(slave, fd)
+    putEnv("TERM", term)
+    let argv = allocCStringArray([cha, "-C", config, file])
+    discard execvp(cstring(cha), argv)
+    quit(127)
+  (master, pid)
+
+proc main() =
+  let file = getEnv("BENCH_FILE")
+  let session = parseSession(getEnv("BENCH_SESSION"))
+  let cha = getEnv("CHA", "./cha")
+  let term = getEnv("BENCH_TERM", "xterm-256color")
+  let cols = parseInt(getEnv("BENCH_COLUMNS", "80"))
+  let lines = parseInt(getEnv("BENCH_LINES", "24"))
+  let config = getEnv("BENCH_CONFIG", "/dev/null")
+  let (master, pid) = spawn(cha, config, file, term, cols, lines)
+  var output = Output(master: master)
+  output.drain()
+  echo "Startup: ", output.bytes, " bytes"
+  var frames = 0
+  var totalBytes = 0
+  var totalTime = 0f64
+  var low = float64.high
+  var high = 0f64
+  var maxBytes = 0
+  for frame in session:
+    for i in 0 ..< frame.count:
+      output.bytes = 0
+      let start = getMonoTime()
+      output.last = start
+      discard write(master, cstring(frame.keys), frame.keys.len)
+      output.drain()
+      let time = (output.last - start).inNanoseconds.float64 / 1e6
+      inc frames
+      totalBytes += output.bytes
+      totalTime += time
+      low = min(low, time)
+      high = max(high, time)
+      maxBytes = max(maxBytes, output.bytes)
+  discard write(master, cstring("q"), 1)
+  output.drain()
+  discard kill(pid, SIGTERM)
+  var status: cint
+  discard waitpid(pid, status, 0)
+  if frames == 0:
+    echo "No frames in session"
+    quit(1)
+  echo "Frames: ", frames, " (", term, ", ", cols, "x", lines, ")"
+  echo "Bytes: total ", totalBytes, ", avg ",
+    (totalBytes.float64 / frames.float64).round(1), ", highest ", maxBytes
+  echo "Time: avg ", (totalTime / float64(frames)).round(3), "ms lowest ",
+    low.round(3), "ms highest ", high.round(3), "ms"
+
+main()
@@ -0,0 +1,70 @@
+# Times setting, running and clearing timers with many of them pending.
+import std/envvars
+import std/math
+import std/monotimes
+import std/strutils
+import std/times
+
+import io/chafile
+import io/console
+import io/timeout
+import monoucha/jsbind
+import monoucha/jsutils
+import monoucha/quickjs
+
+proc evalJSFree(opaque: RootRef; src, file: string) =
+  discard
+
+proc ms(start: MonoTime): float64 =
+  return (getMonoTime() - start).inNanoseconds.float64 / 1e6
+
+proc main() =
+  let counts = getEnv("BENCH_TIMERS", "10000,100000").split(',')
+  let turns = parseInt(getEnv("BENCH_TURNS", "1000"))
+  let rt = newJSRuntime()
+  let ctx = rt.newJSContext()
+  let console = newConsole(cast[ChaFile](stderr))
+  let handler = ctx.eval("() => {}")
+  if JS_IsException(handler):
+    echo "ERROR: failed to compile the handler"
+    quit(1)
+  for s in counts:
+    let n = parseInt(s)
+    var state = newTimeoutState(ctx, evalJSFree, nil)
+    var seed = 12345u32
+    proc next(seed: var uint32): int32 =
+      seed = seed * 1103515245u32 + 12345u32
+      int32(seed shr 8)
+    var ids = newSeq[int32](n)
+    var start = getMonoTime()
+    for i in 0 ..< n:
+      # between one and two hours, so that nothing expires
+      let timeout = 3_600_000'i32 + seed.next() mod 3_600_000'i32
+      ids[i] = state.setTimeout(ttTimeout, handler, timeout, [])
+    let setTime = ms(start)
+    let interval = state.setTimeout(ttInterval, handler, 0, [])
+    start = getMonoTime()
+    var ran = 0
+    for i in 0 ..< turns:
+      discard state.getTimeout()
+      if state.run(console):
+        inc ran
+    let turnTime = ms(start)
+    state.clearTimeout(interval)
+    for i in countdown(ids.high, 1):
+      swap(ids[i], ids[seed.next() mod int32(i + 1)])
+    start = getMonoTime()
+    for id in ids:
+      state.clearTimeout(id)
+    let clearTime = ms(start)
+    if not state.empty:
+      echo "ERROR: timers left after clearing all of them"
+      quit(1)
+    echo n, " timers: set ", setTime.round(3), "ms, ", turns, " turns ",
+      turnTime.round(3), "ms (", ran, " ran), clear ", clearTime.round(3),
+      "ms"
+  JS_FreeValue(ctx, handler)
+  ctx.free()
+  rt.free()
+
+main()